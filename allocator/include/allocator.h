@@ -2,12 +2,96 @@
 #define __ALLOCATOR_H__		1
 
 #include <asm/ioctl.h>
+#include <linux/types.h>
 
 #define ALLOCATOR_IOCTL_ALLOC	_IOC(_IOC_NONE,  'k', 6, 0)
+#define ALLOCATOR_IOCTL_BATCH	_IOWR('k', 7, struct allocator_batch)
+#define ALLOCATOR_IOCTL_FREE	_IOWR('k', 8, struct allocator_free)
+
+/* Largest number of objects of a batch */
+#define ALLOCATOR_MAX_BATCH	(1 << 20)
+
+/* Allocators of a batch */
+enum allocator_family {
+	ALLOCATOR_KMALLOC,
+	ALLOCATOR_KZALLOC,
+	ALLOCATOR_VMALLOC,
+	ALLOCATOR_PAGES,
+	ALLOCATOR_FAMILIES
+};
+
+/* Sizes of the objects of a batch, between min_size and max_size */
+enum allocator_distribution {
+	ALLOCATOR_DIST_FIXED,		/* min_size only */
+	ALLOCATOR_DIST_UNIFORM,		/* uniform */
+	ALLOCATOR_DIST_POW2,		/* powers of 2, uniform exponent */
+	ALLOCATOR_DISTRIBUTIONS
+};
+
+/* Objects of a batch freed right after the batch is allocated */
+enum allocator_free_pattern {
+	ALLOCATOR_FREE_NONE,		/* kept until freed by the ioctl */
+	ALLOCATOR_FREE_ALL,		/* churn, nothing is kept */
+	ALLOCATOR_FREE_ALTERNATE,	/* every other object, leaves holes */
+	ALLOCATOR_FREE_RANDOM,		/* free_percent of the objects */
+	ALLOCATOR_FREE_PATTERNS
+};
+
+/* Objects released by ALLOCATOR_IOCTL_FREE first */
+enum allocator_free_order {
+	ALLOCATOR_ORDER_FIFO,
+	ALLOCATOR_ORDER_LIFO,
+	ALLOCATOR_ORDER_RANDOM,
+	ALLOCATOR_ORDERS
+};
+
+/**
+ * struct allocator_batch - Argument of ALLOCATOR_IOCTL_BATCH
+ * @family:       enum allocator_family
+ * @distribution: enum allocator_distribution
+ * @free_pattern: enum allocator_free_pattern
+ * @free_percent: Percent of the objects freed by ALLOCATOR_FREE_RANDOM
+ * @count:        Number of objects, at most ALLOCATOR_MAX_BATCH
+ * @min_size:     Smallest object size
+ * @max_size:     Largest object size
+ * @handle:       In, group to append the objects to or 0 for a new group.
+ *                Out, group of the objects kept
+ * @allocated:    Out, objects allocated, less than @count on failure
+ * @kept:         Out, objects of the batch left allocated
+ * @bytes:        Out, bytes of the batch left allocated
+ */
+struct allocator_batch {
+	__u32 family;
+	__u32 distribution;
+	__u32 free_pattern;
+	__u32 free_percent;
+	__u64 count;
+	__u64 min_size;
+	__u64 max_size;
+	__u64 handle;
+	__u64 allocated;
+	__u64 kept;
+	__u64 bytes;
+};
+
+/**
+ * struct allocator_free - Argument of ALLOCATOR_IOCTL_FREE
+ * @handle: Group to release objects from, 0 for all the groups
+ * @count:  Objects to release from each group, 0 for all of them
+ * @order:  enum allocator_free_order
+ * @freed:  Out, objects released
+ */
+struct allocator_free {
+	__u64 handle;
+	__u64 count;
+	__u32 order;
+	__u32 pad;
+	__u64 freed;
+};
 
 #ifdef __KERNEL__
 
-#define LOG_LEVEL		KERNEL_
+#define LOG_LEVEL		KERN_DEBUG
 #define ALLOCATOR_MAJOR		42
 #define ALLOCATOR_MINOR		0
 #define NUM_MINORS		1
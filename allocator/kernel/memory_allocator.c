@@ -1,6 +1,10 @@
 /**
  * This module is intended for testing purpose, it allocates kernel memory
  * on demand, using IOCTL calls (ALLOCATOR_IOCTL_ALLOC).
+ *
+ * ALLOCATOR_IOCTL_BATCH allocates many objects in one call and
+ * ALLOCATOR_IOCTL_FREE releases them. The objects are kept in groups, one per
+ * handle, owned by the file descriptor and freed when it is closed.
  * @author Ghennadi Procopciuc
  */
 #include <linux/module.h>
@@ -12,6 +16,13 @@
 #include <linux/sched.h>
 #include <linux/wait.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/random.h>
+#include <linux/math64.h>
 
 #include "../include/allocator.h"
 
@@ -23,6 +34,46 @@ struct allocator_device_data {
 	struct cdev cdev;
 };
 
+/**
+ * struct allocator_object - An object of a group
+ * @address: Address, or struct page for ALLOCATOR_PAGES
+ * @size:    Requested size
+ * @family:  enum allocator_family
+ */
+struct allocator_object {
+	void *address;
+	size_t size;
+	int family;
+};
+
+/**
+ * struct allocator_group - Objects kept under a handle
+ * @list:     Link in the groups of the file
+ * @handle:   Handle given to userspace, never 0
+ * @objects:  Objects, in allocation order
+ * @count:    Number of objects
+ * @capacity: Room in @objects
+ */
+struct allocator_group {
+	struct list_head list;
+	u64 handle;
+	struct allocator_object *objects;
+	size_t count;
+	size_t capacity;
+};
+
+/**
+ * struct allocator_file - Objects owned by an open file
+ * @lock:        Serializes the ioctls of the file
+ * @groups:      Groups of objects
+ * @next_handle: Handle of the next group
+ */
+struct allocator_file {
+	struct mutex lock;
+	struct list_head groups;
+	u64 next_handle;
+};
+
 static int do_open(struct inode *inode, struct file *file);
 static int do_release(struct inode *inode, struct file *file);
 static long do_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
@@ -58,35 +109,396 @@ static int allocator_init(void)
 
 static int do_open(struct inode *inode, struct file *file)
 {
-	logk(LOG_LEVEL "Open ...\n");
+	struct allocator_file *data;
+
+	logk("Open ...");
+
+	data = kzalloc(sizeof(*data), GFP_KERNEL);
+	if (!data)
+		return -ENOMEM;
+
+	mutex_init(&data->lock);
+	INIT_LIST_HEAD(&data->groups);
+	data->next_handle = 1;
+	file->private_data = data;
+
+	return 0;
+}
+
+static void *object_alloc(int family, size_t size)
+{
+	switch (family) {
+	case ALLOCATOR_KMALLOC:
+		return kmalloc(size, GFP_KERNEL | __GFP_NOWARN);
+	case ALLOCATOR_KZALLOC:
+		return kzalloc(size, GFP_KERNEL | __GFP_NOWARN);
+	case ALLOCATOR_VMALLOC:
+		return vmalloc(size);
+	case ALLOCATOR_PAGES:
+		return alloc_pages(GFP_KERNEL | __GFP_NOWARN, get_order(size));
+	}
+
+	return NULL;
+}
+
+static void object_free(struct allocator_object *object)
+{
+	switch (object->family) {
+	case ALLOCATOR_KMALLOC:
+	case ALLOCATOR_KZALLOC:
+		kfree(object->address);
+		break;
+	case ALLOCATOR_VMALLOC:
+		vfree(object->address);
+		break;
+	case ALLOCATOR_PAGES:
+		__free_pages(object->address, get_order(object->size));
+		break;
+	}
+}
+
+static struct allocator_group *find_group(struct allocator_file *data,
+					  u64 handle)
+{
+	struct allocator_group *group;
+
+	list_for_each_entry(group, &data->groups, list)
+		if (group->handle == handle)
+			return group;
+
+	return NULL;
+}
+
+static struct allocator_group *new_group(struct allocator_file *data)
+{
+	struct allocator_group *group;
+
+	group = kzalloc(sizeof(*group), GFP_KERNEL);
+	if (!group)
+		return NULL;
+
+	group->handle = data->next_handle++;
+	list_add_tail(&group->list, &data->groups);
+
+	return group;
+}
+
+static void delete_group(struct allocator_group *group)
+{
+	list_del(&group->list);
+	vfree(group->objects);
+	kfree(group);
+}
+
+/* Make room for @count more objects in @group */
+static int reserve_objects(struct allocator_group *group, size_t count)
+{
+	struct allocator_object *objects;
+	size_t capacity = group->capacity;
+
+	if (group->count + count <= capacity)
+		return 0;
+
+	if (!capacity)
+		capacity = PAGE_SIZE / sizeof(*objects);
+	while (capacity < group->count + count)
+		capacity *= 2;
+
+	objects = vmalloc(capacity * sizeof(*objects));
+	if (!objects)
+		return -ENOMEM;
+
+	if (group->objects) {
+		memcpy(objects, group->objects,
+		       group->count * sizeof(*objects));
+		vfree(group->objects);
+	}
+
+	group->objects = objects;
+	group->capacity = capacity;
+
+	return 0;
+}
+
+/* Free the object at @index, the last object takes its place */
+static void remove_object(struct allocator_group *group, size_t index)
+{
+	object_free(&group->objects[index]);
+	group->objects[index] = group->objects[--group->count];
+}
+
+static size_t batch_size(const struct allocator_batch *batch)
+{
+	unsigned int low, high;
+	u64 range, random;
+
+	switch (batch->distribution) {
+	case ALLOCATOR_DIST_UNIFORM:
+		/* min_size is at least 1, so range does not wrap to 0 */
+		range = batch->max_size - batch->min_size + 1;
+		random = (u64)prandom_u32() << 32 | prandom_u32();
+		return batch->min_size + random - div64_u64(random, range) * range;
+	case ALLOCATOR_DIST_POW2:
+		low = ilog2(batch->min_size);
+		high = ilog2(batch->max_size);
+		return max_t(size_t, 1UL << (low + prandom_u32() %
+					     (high - low + 1)),
+			     batch->min_size);
+	}
+
+	return batch->min_size;
+}
+
+static bool batch_keeps(const struct allocator_batch *batch, u64 index)
+{
+	switch (batch->free_pattern) {
+	case ALLOCATOR_FREE_ALL:
+		return false;
+	case ALLOCATOR_FREE_ALTERNATE:
+		return index % 2 == 0;
+	case ALLOCATOR_FREE_RANDOM:
+		return prandom_u32() % 100 >= batch->free_percent;
+	}
+
+	return true;
+}
+
+static int check_batch(const struct allocator_batch *batch)
+{
+	if (batch->family >= ALLOCATOR_FAMILIES ||
+	    batch->distribution >= ALLOCATOR_DISTRIBUTIONS ||
+	    batch->free_pattern >= ALLOCATOR_FREE_PATTERNS ||
+	    batch->free_percent > 100)
+		return -EINVAL;
+
+	if (!batch->count || batch->count > ALLOCATOR_MAX_BATCH)
+		return -EINVAL;
+
+	if (!batch->min_size || (batch->distribution != ALLOCATOR_DIST_FIXED &&
+				 batch->max_size < batch->min_size))
+		return -EINVAL;
+
+	/* The sizes are size_t once drawn, on 32 bit too */
+	if (batch->min_size > ULONG_MAX ||
+	    (batch->distribution != ALLOCATOR_DIST_FIXED &&
+	     batch->max_size > ULONG_MAX))
+		return -EINVAL;
 
 	return 0;
 }
 
+/**
+ * do_batch - Allocate the objects of a batch and apply its free pattern
+ * @data:  Objects of the file
+ * @batch: Request, its output fields are filled
+ *
+ * The allocation stops at the first failure, @batch->allocated tells how
+ * many objects were allocated.
+ */
+static int do_batch(struct allocator_file *data, struct allocator_batch *batch)
+{
+	struct allocator_group *group;
+	struct allocator_object *object;
+	u64 i;
+	int ret;
+
+	ret = check_batch(batch);
+	if (ret)
+		return ret;
+
+	if (batch->handle) {
+		group = find_group(data, batch->handle);
+		if (!group)
+			return -ENOENT;
+	} else {
+		group = new_group(data);
+		if (!group)
+			return -ENOMEM;
+	}
+
+	ret = reserve_objects(group, batch->count);
+	if (ret)
+		goto out;
+
+	batch->allocated = batch->kept = batch->bytes = 0;
+	for (i = 0; i < batch->count; i++) {
+		object = &group->objects[group->count];
+		object->family = batch->family;
+		object->size = batch_size(batch);
+		object->address = object_alloc(batch->family, object->size);
+		if (!object->address) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		batch->allocated++;
+		if (batch_keeps(batch, i)) {
+			group->count++;
+			batch->kept++;
+			batch->bytes += object->size;
+		} else {
+			object_free(object);
+		}
+
+		cond_resched();
+	}
+
+	/* A partial batch is not an error */
+	if (batch->allocated)
+		ret = 0;
+
+out:
+	batch->handle = group->handle;
+	if (!group->count) {
+		delete_group(group);
+		batch->handle = 0;
+	}
+
+	return ret;
+}
+
+static u64 free_objects(struct allocator_group *group, u64 count, u32 order)
+{
+	u64 freed = 0;
+
+	if (!count || count > group->count)
+		count = group->count;
+
+	if (order == ALLOCATOR_ORDER_FIFO) {
+		for (; freed < count; freed++) {
+			object_free(&group->objects[freed]);
+			cond_resched();
+		}
+
+		/* One move keeps the allocation order of the others */
+		group->count -= count;
+		memmove(group->objects, group->objects + count,
+			group->count * sizeof(*group->objects));
+		return freed;
+	}
+
+	for (; freed < count; freed++) {
+		switch (order) {
+		case ALLOCATOR_ORDER_LIFO:
+			remove_object(group, group->count - 1);
+			break;
+		case ALLOCATOR_ORDER_RANDOM:
+			remove_object(group, prandom_u32() % group->count);
+			break;
+		}
+
+		cond_resched();
+	}
+
+	return freed;
+}
+
+static int do_free(struct allocator_file *data, struct allocator_free *request)
+{
+	struct allocator_group *group, *next;
+
+	if (request->order >= ALLOCATOR_ORDERS)
+		return -EINVAL;
+
+	request->freed = 0;
+	list_for_each_entry_safe(group, next, &data->groups, list) {
+		if (request->handle && group->handle != request->handle)
+			continue;
+
+		request->freed += free_objects(group, request->count,
+					       request->order);
+		if (!group->count)
+			delete_group(group);
+
+		if (request->handle)
+			return 0;
+	}
+
+	return request->handle ? -ENOENT : 0;
+}
+
 static int do_release(struct inode *inode, struct file *file)
 {
-	logk(LOG_LEVEL "Release ...\n");
+	struct allocator_file *data = file->private_data;
+	struct allocator_free request = {
+		.order = ALLOCATOR_ORDER_LIFO,
+	};
+
+	logk("Release ...");
+
+	do_free(data, &request);
+	kfree(data);
 
 	return 0;
 }
 
+/* The objects of ALLOCATOR_IOCTL_ALLOC are kept in the first group */
+static int do_alloc(struct allocator_file *data, unsigned long size)
+{
+	struct allocator_batch batch = {
+		.family = ALLOCATOR_KMALLOC,
+		.distribution = ALLOCATOR_DIST_FIXED,
+		.free_pattern = ALLOCATOR_FREE_NONE,
+		.count = 1,
+		.min_size = size,
+	};
+	struct allocator_group *group;
+
+	if (!list_empty(&data->groups)) {
+		group = list_first_entry(&data->groups,
+					 struct allocator_group, list);
+		batch.handle = group->handle;
+	}
+
+	return do_batch(data, &batch);
+}
+
 static long do_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
+	struct allocator_file *data = file->private_data;
+	struct allocator_batch batch;
+	struct allocator_free request;
+	long ret;
+
+	mutex_lock(&data->lock);
+
 	switch (cmd) {
 	case ALLOCATOR_IOCTL_ALLOC:
-		logk(LOG_LEVEL "Allocates %lu bytes\n", arg);
+		logk("Allocates %lu bytes", arg);
 
 		/* Allocates memory on demand */
-		if (kmalloc(arg, GFP_KERNEL) == NULL) {
-			logk(LOG_LEVEL "Out of memory\n");
-			return -ENOMEM;
+		ret = do_alloc(data, arg);
+		if (ret)
+			logk("Out of memory");
+		break;
+	case ALLOCATOR_IOCTL_BATCH:
+		if (copy_from_user(&batch, (void __user *)arg, sizeof(batch))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		ret = do_batch(data, &batch);
+		if (copy_to_user((void __user *)arg, &batch, sizeof(batch)))
+			ret = -EFAULT;
+		break;
+	case ALLOCATOR_IOCTL_FREE:
+		if (copy_from_user(&request, (void __user *)arg,
+				   sizeof(request))) {
+			ret = -EFAULT;
+			break;
 		}
+
+		ret = do_free(data, &request);
+		if (copy_to_user((void __user *)arg, &request, sizeof(request)))
+			ret = -EFAULT;
 		break;
 	default:
-		return -ENOTTY;
+		ret = -ENOTTY;
 	}
 
-	return 0;
+	mutex_unlock(&data->lock);
+
+	return ret;
 }
 
 static void allocator_exit(void)
@@ -0,0 +1,449 @@
+/**
+ * Load driver for the allocator module.
+ *
+ * Runs several threads, each pinned on a CPU and with its own file
+ * descriptor, issuing ALLOCATOR_IOCTL_BATCH and ALLOCATOR_IOCTL_FREE calls
+ * for a given duration, optionally at a fixed rate. Prints the throughput
+ * and the latency percentiles of the ioctl calls of each thread.
+ *
+ * Usage : allocator_load [-t threads] [-c first cpu] [-d seconds]
+ *                        [-r ops/s] [-f family] [-D distribution]
+ *                        [-s min[:max]] [-b objects] [-m free %]
+ *                        [-l live objects] [-o fifo|lifo|random]
+ * @author Ghennadi Procopciuc
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "../include/allocator.h"
+
+#define DEVICE_PATH		"/dev/memory_allocator"
+#define NS_PER_SEC		1000000000ULL
+#define DEFAULT_DURATION	10
+#define DEFAULT_SIZE		64
+#define DEFAULT_BATCH		16
+#define DEFAULT_FREE_PERCENT	50
+#define DEFAULT_LIVE		(1 << 16)
+#define SAMPLES_CHUNK		(1 << 16)
+
+static const char *family_names[] = {"kmalloc", "kzalloc", "vmalloc", "pages"};
+static const char *distribution_names[] = {"fixed", "uniform", "pow2"};
+static const char *order_names[] = {"fifo", "lifo", "random"};
+
+/**
+ * struct load_thread - Load issued by one thread
+ * @thread:   Thread
+ * @id:       Thread index
+ * @cpu:      CPU the thread is pinned on
+ * @fd:       Descriptor of the device, its objects are private to the thread
+ * @handle:   Group of the objects kept by the thread
+ * @live:     Objects currently kept
+ * @allocs:   ALLOCATOR_IOCTL_BATCH calls
+ * @frees:    ALLOCATOR_IOCTL_FREE calls
+ * @failures: Calls that failed
+ * @ns:       Time taken by the whole run
+ * @samples:  Latency of each call, in ns
+ * @count:    Number of samples
+ * @capacity: Room in @samples
+ */
+struct load_thread {
+	pthread_t thread;
+	unsigned int id;
+	int cpu;
+	int fd;
+	unsigned long long handle;
+	unsigned long long live;
+	unsigned long long allocs;
+	unsigned long long frees;
+	unsigned long long failures;
+	unsigned long long ns;
+	unsigned long long *samples;
+	size_t count;
+	size_t capacity;
+};
+
+static unsigned int threads_num = 1;
+static int first_cpu;
+static unsigned int duration = DEFAULT_DURATION;
+static unsigned long rate;
+static unsigned int free_percent = DEFAULT_FREE_PERCENT;
+static unsigned long long live_limit = DEFAULT_LIVE;
+static unsigned int order = ALLOCATOR_ORDER_FIFO;
+static struct allocator_batch batch_template = {
+	.family = ALLOCATOR_KMALLOC,
+	.distribution = ALLOCATOR_DIST_FIXED,
+	.free_pattern = ALLOCATOR_FREE_NONE,
+	.count = DEFAULT_BATCH,
+	.min_size = DEFAULT_SIZE,
+	.max_size = DEFAULT_SIZE,
+};
+
+static pthread_barrier_t start_barrier;
+
+static void print_usage(char **argv)
+{
+	fprintf(stderr, "Usage : %s [-t threads] [-c first cpu] [-d seconds] "
+		"[-r ops/s] [-f kmalloc|kzalloc|vmalloc|pages] "
+		"[-D fixed|uniform|pow2] [-s min[:max]] [-b objects] "
+		"[-m free %%] [-l live objects] [-o fifo|lifo|random]\n",
+		argv[0]);
+	exit(EXIT_FAILURE);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/* Sleep until @deadline, on the CLOCK_MONOTONIC scale */
+static void sleep_until(unsigned long long deadline)
+{
+	struct timespec ts = {
+		.tv_sec = deadline / NS_PER_SEC,
+		.tv_nsec = deadline % NS_PER_SEC,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
+
+static void pin_thread(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+		fprintf(stderr, "Unable to pin a thread on CPU %d\n", cpu);
+}
+
+static int parse_name(const char *name, const char **names, unsigned int num)
+{
+	unsigned int i;
+
+	for (i = 0; i < num; i++)
+		if (!strcmp(name, names[i]))
+			return i;
+
+	return -1;
+}
+
+static void add_sample(struct load_thread *load, unsigned long long ns)
+{
+	unsigned long long *samples;
+
+	if (load->count == load->capacity) {
+		samples = realloc(load->samples, (load->capacity +
+				  SAMPLES_CHUNK) * sizeof(*samples));
+		if (!samples)
+			return;
+
+		load->samples = samples;
+		load->capacity += SAMPLES_CHUNK;
+	}
+
+	load->samples[load->count++] = ns;
+}
+
+static int do_alloc(struct load_thread *load)
+{
+	struct allocator_batch batch = batch_template;
+
+	batch.handle = load->handle;
+	if (ioctl(load->fd, ALLOCATOR_IOCTL_BATCH, &batch) < 0)
+		return -1;
+
+	load->handle = batch.handle;
+	load->live += batch.kept;
+	load->allocs++;
+
+	return batch.allocated == batch.count ? 0 : -1;
+}
+
+static int do_free(struct load_thread *load, unsigned long long count)
+{
+	struct allocator_free request = {
+		.handle = load->handle,
+		.count = count,
+		.order = order,
+	};
+
+	if (ioctl(load->fd, ALLOCATOR_IOCTL_FREE, &request) < 0)
+		return -1;
+
+	/* The kernel deletes a group once it is empty */
+	load->live -= request.freed;
+	if (!load->live)
+		load->handle = 0;
+	load->frees++;
+
+	return 0;
+}
+
+/* Free when asked by the mix, or when the thread keeps too many objects */
+static int next_is_free(struct load_thread *load, unsigned int *seed)
+{
+	if (!load->live)
+		return 0;
+
+	if (load->live + batch_template.count > live_limit)
+		return 1;
+
+	return (unsigned int)rand_r(seed) % 100 < free_percent;
+}
+
+static void *load_thread_fn(void *data)
+{
+	struct load_thread *load = data;
+	unsigned long long start, end, deadline, next, before, after;
+	unsigned int seed = load->id + 1;
+	unsigned long long interval = rate ? NS_PER_SEC / rate : 0;
+	int ret;
+
+	pin_thread(load->cpu);
+
+	pthread_barrier_wait(&start_barrier);
+
+	start = next = now_ns();
+	deadline = start + duration * NS_PER_SEC;
+	for (end = start; end < deadline; end = after) {
+		if (interval) {
+			sleep_until(next);
+			next += interval;
+		}
+
+		before = now_ns();
+		if (next_is_free(load, &seed))
+			ret = do_free(load, batch_template.count);
+		else
+			ret = do_alloc(load);
+		after = now_ns();
+
+		add_sample(load, after - before);
+		if (ret)
+			load->failures++;
+	}
+	load->ns = end - start;
+
+	/* Leave the device as it was found */
+	if (load->live)
+		do_free(load, 0);
+
+	return NULL;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest rank percentile of sorted samples */
+static unsigned long long percentile(const unsigned long long *samples,
+				     size_t count, unsigned int percent)
+{
+	size_t rank = (count * percent + 99) / 100;
+
+	if (!count)
+		return 0;
+
+	return samples[rank ? rank - 1 : 0];
+}
+
+static void print_latencies(const unsigned long long *samples, size_t count)
+{
+	printf(" p50 %.1f p90 %.1f p99 %.1f max %.1f us\n",
+	       percentile(samples, count, 50) / 1e3,
+	       percentile(samples, count, 90) / 1e3,
+	       percentile(samples, count, 99) / 1e3,
+	       percentile(samples, count, 100) / 1e3);
+}
+
+static void print_thread(struct load_thread *load)
+{
+	qsort(load->samples, load->count, sizeof(*load->samples),
+	      compare_samples);
+
+	printf("Thread %u CPU %d.......%.0f ops/s %llu allocs %llu frees "
+	       "%llu failures", load->id, load->cpu,
+	       (double)load->count * NS_PER_SEC / load->ns, load->allocs,
+	       load->frees, load->failures);
+	print_latencies(load->samples, load->count);
+}
+
+/* Latencies of all the threads together */
+static void print_total(struct load_thread *loads)
+{
+	unsigned long long *samples, ns = 0;
+	size_t count = 0, i;
+
+	for (i = 0; i < threads_num; i++) {
+		count += loads[i].count;
+		if (loads[i].ns > ns)
+			ns = loads[i].ns;
+	}
+
+	samples = malloc((count + 1) * sizeof(*samples));
+	if (!samples) {
+		fprintf(stderr, "Unable to allocate the samples\n");
+		return;
+	}
+
+	for (count = 0, i = 0; i < threads_num; i++) {
+		memcpy(samples + count, loads[i].samples,
+		       loads[i].count * sizeof(*samples));
+		count += loads[i].count;
+	}
+	qsort(samples, count, sizeof(*samples), compare_samples);
+
+	printf("Threads %u.......%.0f ops/s", threads_num,
+	       ns ? (double)count * NS_PER_SEC / ns : 0);
+	print_latencies(samples, count);
+
+	free(samples);
+}
+
+static void parse_size(const char *arg)
+{
+	char *end;
+
+	batch_template.min_size = strtoull(arg, &end, 10);
+	batch_template.max_size = batch_template.min_size;
+	if (*end == ':')
+		batch_template.max_size = strtoull(end + 1, NULL, 10);
+}
+
+#define NAMES_NUM(names)	(sizeof(names) / sizeof(names[0]))
+
+int main(int argc, char **argv)
+{
+	struct load_thread *loads;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int i;
+	int opt, ret = EXIT_SUCCESS;
+
+	while ((opt = getopt(argc, argv, "t:c:d:r:f:D:s:b:m:l:o:")) != -1) {
+		switch (opt) {
+		case 't':
+			threads_num = strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			first_cpu = strtol(optarg, NULL, 10);
+			break;
+		case 'd':
+			duration = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			opt = parse_name(optarg, family_names,
+					 NAMES_NUM(family_names));
+			if (opt < 0)
+				print_usage(argv);
+			batch_template.family = opt;
+			break;
+		case 'D':
+			opt = parse_name(optarg, distribution_names,
+					 NAMES_NUM(distribution_names));
+			if (opt < 0)
+				print_usage(argv);
+			batch_template.distribution = opt;
+			break;
+		case 's':
+			parse_size(optarg);
+			break;
+		case 'b':
+			batch_template.count = strtoull(optarg, NULL, 10);
+			break;
+		case 'm':
+			free_percent = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			live_limit = strtoull(optarg, NULL, 10);
+			break;
+		case 'o':
+			opt = parse_name(optarg, order_names,
+					 NAMES_NUM(order_names));
+			if (opt < 0)
+				print_usage(argv);
+			order = opt;
+			break;
+		default:
+			print_usage(argv);
+		}
+	}
+
+	if (optind != argc || !threads_num || !duration || first_cpu < 0 ||
+	    free_percent > 100 || !batch_template.count ||
+	    batch_template.count > ALLOCATOR_MAX_BATCH ||
+	    !batch_template.min_size ||
+	    batch_template.max_size < batch_template.min_size)
+		print_usage(argv);
+
+	loads = calloc(threads_num, sizeof(*loads));
+	if (!loads) {
+		fprintf(stderr, "Unable to allocate the threads\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < threads_num; i++) {
+		loads[i].fd = open(DEVICE_PATH, O_RDONLY);
+		if (loads[i].fd < 0) {
+			fprintf(stderr, "Unable to open %s : %s\n", DEVICE_PATH,
+				strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	pthread_barrier_init(&start_barrier, NULL, threads_num);
+
+	for (i = 0; i < threads_num; i++) {
+		loads[i].id = i;
+		loads[i].cpu = (first_cpu + i) % (cpus > 0 ? cpus : 1);
+		if (pthread_create(&loads[i].thread, NULL, load_thread_fn,
+				   &loads[i])) {
+			fprintf(stderr, "Unable to create thread %u\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < threads_num; i++)
+		pthread_join(loads[i].thread, NULL);
+
+	printf("# Family %s distribution %s size %llu:%llu batch %llu "
+	       "free %u%% order %s rate %lu\n",
+	       family_names[batch_template.family],
+	       distribution_names[batch_template.distribution],
+	       batch_template.min_size, batch_template.max_size,
+	       batch_template.count, free_percent, order_names[order], rate);
+	for (i = 0; i < threads_num; i++) {
+		print_thread(&loads[i]);
+		if (loads[i].failures)
+			ret = EXIT_FAILURE;
+	}
+	print_total(loads);
+
+	pthread_barrier_destroy(&start_barrier);
+	for (i = 0; i < threads_num; i++) {
+		close(loads[i].fd);
+		free(loads[i].samples);
+	}
+	free(loads);
+
+	return ret;
+}
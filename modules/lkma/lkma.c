@@ -3,10 +3,14 @@
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/proc_fs.h>
-#include <linux/sort.h>
-#include <linux/bsearch.h>
 #include <linux/uaccess.h>
 #include <linux/rculist.h>
+#include <linux/kallsyms.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/sort.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
 
 #include <linux/fs.h>		/* for basic filesystem */
 #include <linux/proc_fs.h>	/* for the proc filesystem */
@@ -34,15 +38,19 @@ MODULE_LICENSE("GPL");
 
 #define PROC_FILENAME       "lkma"
 #define DEFAULT_DB_SIZE     2000
-#define DEFAULT_STACK_SIZE  40
-
-struct stack {
-	u8 **data;
-	int size;
-	int capacity;
-};
-
-typedef struct stack buffer_t;
+#define MAX_PATH_LEN        512
+#define DEPTH_COMMAND       "DEPTH"
+#define MARK_COMMAND        "MARK"
+#define DELTA_COMMAND       "DELTA"
+#define PEAK_COMMAND        "PEAK"
+#define LIFETIME_COMMAND    "LIFETIME"
+#define RESET_COMMAND       "RESET"
+#define SLACK_COMMAND       "SLACK"
+#define CACHES_COMMAND      "CACHES"
+#define NUMA_COMMAND        "NUMA"
+#define CHAINS_COMMAND      "CHAINS"
+#define HISTORY_FILENAME    "lkma_history"
+#define MAX_VARINT_LEN      10
 
 static struct proc_dir_entry *lkma_entry;
 
@@ -58,20 +66,219 @@ static int buffer_capacity;
 /* User defined filter */
 static char *filter;
 
+/**
+ * enum report_mode - Report printed by the reads of /proc/lkma
+ * @REPORT_FILES:     Memory of each file, or of the filtered ones
+ * @REPORT_TREE:      Subtree totals up to report_depth @see dump_tree
+ * @REPORT_DELTA:     Changes since the last mark @see dump_delta
+ * @REPORT_PEAKS:     Current and peak memory @see dump_peaks
+ * @REPORT_LIFETIMES: Lifetime histograms @see dump_lifetimes
+ * @REPORT_SLACK:     Internal fragmentation @see dump_slack
+ * @REPORT_CACHES:    Slab memory per cache and file @see dump_caches
+ * @REPORT_NUMA:      Memory per NUMA node @see dump_numa
+ * @REPORT_CHAINS:    Memory per call chain, folded @see dump_chains
+ */
+enum report_mode {
+	REPORT_FILES,
+	REPORT_TREE,
+	REPORT_DELTA,
+	REPORT_PEAKS,
+	REPORT_LIFETIMES,
+	REPORT_SLACK,
+	REPORT_CACHES,
+	REPORT_NUMA,
+	REPORT_CHAINS,
+};
+
+static enum report_mode report_mode;
+
+/* Depth of the tree report */
+static unsigned long report_depth;
+
+/* Memory allocated by each node at the last mark @see take_mark */
+static long *baseline;
+
+/**
+ * struct module_mark - Memory allocated by a module at the last mark
+ * @name:      Module name, the module may be unloaded since
+ * @allocated: Memory allocated by the module
+ * @seen:      Whether the module is still loaded, set by dump_delta
+ */
+struct module_mark {
+	char name[MODULE_NAME_LEN];
+	long allocated;
+	bool seen;
+};
+
+static struct module_mark *module_marks;
+static unsigned int module_marks_num;
+
+/**
+ * struct delta_entry - Line of the delta and slack reports
+ * @delta:  Change since the last mark, or wasted bytes
+ * @value:  Current value
+ * @node:   Node id, used if @module is NULL
+ * @module: Module name
+ */
+struct delta_entry {
+	long delta;
+	long value;
+	unsigned long node;
+	const char *module;
+};
+
+/* NUMA node printed by the NUMA report, -1 for all of them */
+static int numa_filter;
+
+/* Cache printed by the caches report, empty for all of them */
+static char cache_filter[KALLSYMS_CACHE_NAME_LEN];
+
+/**
+ * struct cache_entry - Line of the caches report
+ * @name:  Cache name
+ * @node:  Node id, 0 for the modules
+ * @size:  Bytes allocated by the pair
+ * @count: Objects allocated by the pair
+ */
+struct cache_entry {
+	const char *name;
+	unsigned long node;
+	long size;
+	long count;
+};
+
+/* Memory allocated by each subtree @see compute_totals */
+static long *totals;
+
+/**
+ * struct node_cache - Cached memory allocated by a subtree
+ * @value: Memory allocated by the subtree
+ * @epoch: Epoch in which @value was computed, 0 if it was never computed
+ */
+struct node_cache {
+	long value;
+	u32 epoch;
+};
+
+/* Subtree totals kept between reports @see get_node_value */
+static struct node_cache *cache;
+
+/* Epoch of the current report */
+static u32 report_epoch;
+
+/* Path of the node being printed @see get_node_path */
+static char path_buffer[MAX_PATH_LEN];
+
+/* Serializes the reports, they share buffer, totals, cache and path_buffer */
+static DEFINE_MUTEX(report_mutex);
+
+/* Sampling period of the history in milliseconds, 0 disables the sampler */
+static unsigned int sample_period;
+module_param(sample_period, uint, S_IRUGO);
+MODULE_PARM_DESC(sample_period, "History sampling period in ms, 0 = off");
+
+/* Size of the history ring in KiB */
+static unsigned int history_size = 256;
+module_param(history_size, uint, S_IRUGO);
+MODULE_PARM_DESC(history_size, "History ring size in KiB");
+
+/* Sampler thread, NULL if the history is disabled */
+static struct task_struct *sampler;
+
+/* Ring of encoded frames @see take_sample */
+static u8 *history;
+static size_t history_capacity;
+
+/* Ring offsets of the oldest frame and of the first free byte */
+static size_t history_tail, history_head;
+
+/* Bytes used in the ring and number of frames stored in them */
+static size_t history_used;
+static unsigned long history_frames;
+
+/* Incremented each time the oldest frame is dropped */
+static unsigned long history_generation;
+
+/* Values of all nodes at history_base_time, before the oldest frame */
+static long *history_base;
+static s64 history_base_time;
+
+/* Values of all nodes at the newest frame and its time */
+static long *history_last;
+static s64 history_last_time;
+
+/* Values of all nodes at the history entry being printed */
+static long *history_replay;
+
+/* Scratch space used to encode a frame before it is copied to the ring */
+static u8 *frame_buffer;
+
+/* Path of the history entry being printed */
+static char history_path[MAX_PATH_LEN];
+
+/**
+ * struct history_cursor - Position of a reader of the history
+ * @pos:        Number of entries returned so far
+ * @generation: history_generation when the cursor was rewound
+ * @node:       Node of the current entry
+ * @delta:      Change of the node memory in the current entry
+ * @time:       Time of the current entry in milliseconds since boot
+ * @off:        Ring offset of the next entry
+ * @frame:      Number of frames started
+ * @left:       Entries left in the current frame
+ * @in_base:    Whether the cursor is still in history_base
+ */
+struct history_cursor {
+	loff_t pos;
+	unsigned long generation;
+	unsigned long node;
+	long delta;
+	s64 time;
+	size_t off;
+	unsigned long frame;
+	unsigned long left;
+	bool in_base;
+};
+
+static struct history_cursor history_cursor;
+
+/* Protects the ring, the arrays above and history_cursor */
+static DEFINE_MUTEX(history_mutex);
+
 /* Mutex which protect modules list */
 extern struct mutex module_mutex;
 extern struct list_head modules;
 
-/* Maximum node offset from kallsyms_trie */
-static unsigned long kallsyms_trie_size;
-
 /* Exported data from kallsysms */
-extern u8 kallsyms_trie[];
-extern const unsigned long kallsyms_offsets[];
-extern const unsigned long kallsyms_num_syms;
-
-/* db stores all files defined in kallsyms_trie sorted with db_cmp */
-buffer_t db = { .size = 0, .capacity = 0, .data = NULL };
+extern const struct kallsyms_trie_node kallsyms_trie[];
+extern const char kallsyms_trie_names[];
+extern atomic_long_t kallsyms_trie_sizes[];
+extern atomic_long_t kallsyms_trie_peaks[];
+extern atomic_long_t kallsyms_trie_requested[];
+extern atomic_long_t kallsyms_trie_pages[];
+
+/* nr_node_ids counters per node, NULL early at boot */
+extern atomic_long_t *kallsyms_trie_numa;
+extern atomic_t kallsyms_trie_lifetimes[];
+extern const unsigned long kallsyms_trie_num_nodes;
+
+/* Last update of each subtree @see kallsyms_trie_touch */
+extern u32 kallsyms_trie_stamps[];
+extern atomic_t kallsyms_trie_epoch;
+
+/* Memory of the (kmem_cache, node) pairs @see kallsyms_add_cache_memory */
+extern struct kallsyms_cache_slot kallsyms_cache_slots[];
+extern atomic_long_t kallsyms_cache_sizes[];
+extern atomic_long_t kallsyms_cache_counts[];
+extern atomic_long_t kallsyms_cache_overflow;
+
+/* Unique call chains, NULL unless booted with kmemleak_chains=1 */
+extern struct kallsyms_chain *kallsyms_chains;
+extern long __percpu *kallsyms_chain_sizes;
+extern atomic_long_t kallsyms_chain_overflow;
+
+/* Ids of all nodes from kallsyms_trie sorted by name */
+extern const u32 kallsyms_trie_index[];
 
 /**
  * realloc - reallocate memory allocated with kmalloc and friends
@@ -96,350 +303,267 @@ void *realloc(void *old_ptr, size_t old_size,
 }
 
 /**
- * stack_init - Initialize a stack
- * @st:       Stack address
- * @capacity: Initial stack capacity
+ * get_node_filename - Get filename field from a trie node
+ * @node: Node id
  */
-static int stack_init(struct stack *st, int capacity)
+static const char *get_node_filename(unsigned long node)
 {
-	klog("Stack init %p with capacity : %d", st, capacity);
-	st->size = 0;
-	st->capacity = capacity;
-	st->data = kmalloc(sizeof(*st->data) * capacity, GFP_KERNEL);
-
-	if (!st->data) {
-		kerr("Unable to allocate memory with kmalloc");
-		return -ENOMEM;
-	}
-
-	return 0;
+	return kallsyms_trie_names + kallsyms_trie[node].name;
 }
 
 /**
- * stack_push - Add an element to stack
- * @st:      Stack address
- * @element: Element to push
+ * get_node_parent - Get the parent id from a trie node
+ * @node: Node id
  */
-static int stack_push(struct stack *st, u8 * element)
+static unsigned long get_node_parent(unsigned long node)
 {
-	int ret;
-
-	if (st->data == NULL) {
-		ret = stack_init(st, DEFAULT_STACK_SIZE);
-		if (ret) {
-			kerr("Stack initialization failed");
-			return ret;
-		}
-	}
-
-	if (st->size == st->capacity) {
-		klog("Realloc to %d", st->capacity * 2);
-		st->data = realloc(st->data, st->capacity * sizeof(*st->data),
-				   st->capacity * sizeof(*st->data) * 2,
-				   GFP_KERNEL);
-		if (!st->data) {
-			return -ENOMEM;
-		}
-		st->capacity *= 2;
-	}
-
-	st->data[st->size] = element;
-	st->size++;
-
-	return 0;
+	return kallsyms_trie[node].parent;
 }
 
 /**
- * stack_empty - Test if stack is empty
- * @st:  Stack address
+ * get_node_children - Get the id of the first child from a trie node
+ * @node: Node id
  *
- * Return :
- * true - Stack is empty
- * false - Stack has a few elements
+ * The children of a node have consecutive ids
+ * @see struct kallsyms_trie_node
  */
-static bool stack_empty(struct stack *st)
+static unsigned long get_node_children(unsigned long node)
 {
-	return st->size == 0;
+	return kallsyms_trie[node].children;
 }
 
 /**
- * stack_pop - Remove the value from the top of the stack
- * @st: Stack address
- *
- * Return: Value from the top of the stack
+ * get_node_children_num - Get the number of children from a trie node
+ * @node: Node id
  */
-static u8 *stack_pop(struct stack *st)
+static unsigned long get_node_children_num(unsigned long node)
 {
-	if (st->size == 0) {
-		return NULL;
-	}
-
-	return st->data[--st->size];
+	return kallsyms_trie[node].children_num;
 }
 
 /**
- * stack_destroy - Remove all elements from stack
- * @st: Stack address
+ * get_node_allocated - Get the memory allocated from a trie node, without
+ *                      its children
+ * @node: Node id
  */
-static void stack_destroy(struct stack *st)
+static long get_node_allocated(unsigned long node)
 {
-	st->capacity = 0;
-	st->size = 0;
-	kfree(st->data);
+	return atomic_long_read(&kallsyms_trie_sizes[node]);
 }
 
 /**
- * get_node_filename - Get filename field from a trie node
- * @node: Node address in trie serialization
+ * get_node_requested - Get the memory requested from a trie node
+ * @node: Node id
+ *
+ * It is at most get_node_allocated(@node), which counts the whole blocks.
  */
-static u8 *get_node_filename(u8 * node)
+static long get_node_requested(unsigned long node)
 {
-	return node + sizeof(unsigned long);
+	return atomic_long_read(&kallsyms_trie_requested[node]);
 }
 
 /**
- * get_node_parent - Get the parent offset from a trie node
- * @node: Node address in trie serialization
+ * get_node_pages - Get the memory taken from the page allocator by a trie node
+ * @node: Node id
+ *
+ * The pages are only counted when the kernel is booted with kmemleak_pages=1.
+ * The vmalloc and percpu backing pages are also registered with kmemleak, they
+ * are counted both here and in get_node_allocated(@node).
  */
-static unsigned long get_node_parent(u8 * node)
+static long get_node_pages(unsigned long node)
 {
-	u8 *tmp_node = node;
-
-	/* Size */
-	tmp_node += sizeof(unsigned long);
-
-	/* Skip filename and parent */
-	return *(unsigned long *)(tmp_node + strlen(tmp_node) + 1);
+	return atomic_long_read(&kallsyms_trie_pages[node]);
 }
 
 /**
- * get_node_children - Get the children array from a trie node
- * @node: Node address in trie serialization
- *
- * From returned address you can easily obtain the number of children by
- * decreasing the address with sizeof(unsigned long)
- * @see kallsyms_trie [Serialization]
+ * get_node_peak - Get the highest memory allocated from a trie node
+ * @node: Node id
  */
-static unsigned long *get_node_children(u8 * node)
+static long get_node_peak(unsigned long node)
 {
-	u8 *tmp_node = node;
-
-	/* Size */
-	tmp_node += sizeof(unsigned long);
-
-	/* Skip filename and parent */
-	tmp_node += strlen(tmp_node) + 1 + sizeof(unsigned long);
-
-	/* Skip children_num */
-	tmp_node += sizeof(unsigned long);
+	return atomic_long_read(&kallsyms_trie_peaks[node]);
+}
 
-	return (unsigned long *)tmp_node;
+/**
+ * get_node_lifetimes - Get the lifetime histogram of a trie node
+ * @node: Node id
+ */
+static atomic_t *get_node_lifetimes(unsigned long node)
+{
+	return kallsyms_trie_lifetimes + node * KALLSYMS_LIFETIME_BUCKETS;
 }
 
 /**
- * get_node_size - Get the allocated size from a trie node
- * @node: Node address in trie serialization
+ * get_node_next_sibling - Get the next sibling of a trie node
+ * @node: Node id
+ *
+ * Return: Id of the next sibling or 0 if @node is the last child
  */
-static unsigned long get_node_size(u8 * node)
+static unsigned long get_node_next_sibling(unsigned long node)
 {
-	unsigned long *children = get_node_children(node);
+	unsigned long parent = get_node_parent(node);
+
+	if (node != 0 && node + 1 < get_node_children(parent) +
+	    get_node_children_num(parent))
+		return node + 1;
 
-	return (char *)children + (*(children - 1) * sizeof(unsigned long)) -
-	    (char *)node;
+	return 0;
 }
 
 /**
- * update_kallsyms_trie_size - Get the trie size in kallsyms_trie_size
- *                             variable [global]
+ * find_first_file - Search the first node with the given name
+ * @filename: File name
+ *
+ * Return: Position in kallsyms_trie_index of the first node named @filename
+ *         or kallsyms_trie_num_nodes if there is no such node
  */
-static void update_kallsyms_trie_size(void)
+static unsigned long find_first_file(const char *filename)
 {
-	unsigned long i;
+	unsigned long left = 0, right = kallsyms_trie_num_nodes, mid;
 
-	/* Iterate over all symbols to find the offset of the latest node */
-	for (i = 0; i < kallsyms_num_syms; i++) {
-		if (kallsyms_trie_size < kallsyms_offsets[i]) {
-			kallsyms_trie_size = kallsyms_offsets[i];
-		}
+	while (left < right) {
+		mid = left + (right - left) / 2;
+
+		if (strcmp(get_node_filename(kallsyms_trie_index[mid]),
+			   filename) < 0)
+			left = mid + 1;
+		else
+			right = mid;
 	}
 
-	kallsyms_trie_size += get_node_size(kallsyms_trie + kallsyms_trie_size);
+	if (left < kallsyms_trie_num_nodes &&
+	    strcmp(get_node_filename(kallsyms_trie_index[left]), filename) == 0)
+		return left;
+
+	return kallsyms_trie_num_nodes;
 }
 
+#ifdef DEBUG
+static void print_node(unsigned long node)
+{
+	klog("\tSize = %ld", get_node_allocated(node));
+	klog("\tFilename = %s", get_node_filename(node));
+	klog("\tParent = %lu", get_node_parent(node));
+	klog("\tChildren = %lu, num = %lu", get_node_children(node),
+	     get_node_children_num(node));
+}
+#endif
+
 /**
- * db_cmp - Database comparator.
- * @a: A node from db
- * @b: A node from db
+ * start_report - Start a new epoch for the cached subtree totals
  *
- * It aids to sort db alphabetically.
+ * Updates made from now on stamp the nodes with the new epoch, so they are
+ * seen as changes by the next report. Must be called with report_mutex held.
  */
-static int db_cmp(const void *a, const void *b)
+static void start_report(void)
 {
-	return strcmp(*(char **)a, *(char **)b);
+	report_epoch = atomic_inc_return(&kallsyms_trie_epoch);
 }
 
 /**
- * db_add_file - Add file to the db
- * @filename: File to add
+ * node_changed - Test if a subtree changed since its total was cached
+ * @node: Node id
+ *
+ * The kernel stamps a node and all its ancestors with the current epoch on
+ * each update, a stamp not older than the cached epoch means a new update.
  */
-static int inline db_add_file(u8 * filename)
+static bool node_changed(unsigned long node)
 {
-	return stack_push(&db, filename);
+	return cache[node].epoch == 0 ||
+	    (s32)(ACCESS_ONCE(kallsyms_trie_stamps[node]) -
+		  cache[node].epoch) >= 0;
 }
 
 /**
- * build_db - Build db from trie content
+ * get_node_value - Get allocated size from a node
+ * @node: Node id
+ *
+ * Only the subtrees changed since the previous report are visited, the others
+ * come from the cache, so polling a directory costs O(changed subtrees). The
+ * recursion is bounded by the depth of the source tree. Must be called with
+ * report_mutex held, after start_report.
  */
-static int build_db(void)
+static long get_node_value(unsigned long node)
 {
-	unsigned long offset;
-	int ret;
+	unsigned long child, end;
+	long sum;
 
-	update_kallsyms_trie_size();
-
-	/* Add all files name from kallsyms_trie to db */
-	for (offset = 0; offset < kallsyms_trie_size;) {
-		ret = db_add_file(get_node_filename(kallsyms_trie + offset));
-
-		if (ret) {
-			kerr("Failed to add file %s to our database",
-			     kallsyms_trie + offset);
-			return ret;
-		}
-
-		offset += get_node_size(kallsyms_trie + offset);
-	}
-
-	/* Sort files by name */
-	sort(db.data, db.size, sizeof(*db.data), db_cmp, NULL);
+	if (!node_changed(node))
+		return cache[node].value;
 
 #ifdef DEBUG
-	for (offset = 0; offset < db.size; offset++) {
-		klog("File %s parent = %lu", db.data[offset],
-		     get_node_parent(db.data[offset] - sizeof(unsigned long)));
-	}
+	klog("Changed :");
+	print_node(node);
 #endif
 
-	return 0;
-}
-
-#ifdef DEBUG
-static void print_node(u8 * node)
-{
-	unsigned long children_num;
-	unsigned long i;
-
-	if (!node) {
-		kerr("Empty node !!!");
-		return;
-	}
-
-	klog("\tSize = %lu", *(unsigned long *)node);
+	sum = get_node_allocated(node);
 
-	/* Filename */
-	node += sizeof(unsigned long);
-	klog("\tFilename = %s", node);
+	end = get_node_children(node) + get_node_children_num(node);
+	for (child = get_node_children(node); child < end; child++)
+		sum += get_node_value(child);
 
-	/* Parent */
-	node += strlen(node) + 1;
-	klog("\tParent = %lu", *(unsigned long *)node);
+	cache[node].value = sum;
+	cache[node].epoch = report_epoch;
 
-	/* Children */
-	node += sizeof(unsigned long);
-	children_num = *(unsigned long *)node;
-	klog("\tChildren num = %lu", children_num);
-
-	for (i = 0; i < children_num; i++) {
-		node += sizeof(unsigned long);
-		klog("\t\tchildren[%lu] = %lu", i, *(unsigned long *)node);
-	}
+	return sum;
 }
-#endif
 
 /**
- * get_node_value - Get allocated size from a node
- * @node: Node address in trie serialization
+ * compute_totals - Compute the memory allocated by every subtree in totals
+ *
+ * A child always has a greater id than its parent, so a single pass over
+ * the nodes in reverse order has added all the children to a node before
+ * the node is added to its parent. Must be called with report_mutex held.
  */
-static unsigned long get_node_value(u8 * node)
+static void compute_totals(void)
 {
-	struct stack st;
-	unsigned long children_num;
-	unsigned long sum = 0;
 	unsigned long i;
-	unsigned long *children;
-	int ret;
 
-	if (!node) {
-		kerr("Given NULL pointer !!!");
-		return 0;
-	}
-
-	stack_init(&st, DEFAULT_STACK_SIZE);
-
-#ifdef DEBUG
-	klog("First node :");
-	print_node(node);
-#endif
-	ret = stack_push(&st, node);
-	if (ret) {
-		kerr("Failed to push node to stack");
-		goto out;
-	}
-
-	while (!stack_empty(&st)) {
-		node = stack_pop(&st);
-
-		sum += atomic_read((atomic_t *) node);
-
-#ifdef DEBUG
-		klog("From stack :");
-		print_node(node);
-#endif
-
-		children = get_node_children(node);
-		children_num = *((unsigned long *)children - 1);
-
-		klog("Children num : %lu", children_num);
-		for (i = 0; i < children_num; i++) {
-			ret = stack_push(&st, kallsyms_trie + children[i]);
+	memset(totals, 0, sizeof(*totals) * kallsyms_trie_num_nodes);
 
-			if (ret) {
-				kerr("Failed to push node to stack");
-				goto out;
-			}
-		}
+	for (i = kallsyms_trie_num_nodes - 1; i > 0; i--) {
+		totals[i] += get_node_allocated(i);
+		totals[get_node_parent(i)] += totals[i];
 	}
-
- out:
-	stack_destroy(&st);
-
-	return sum;
+	totals[0] += get_node_allocated(0);
 }
 
 /**
- * get_node_path - Build a node path from the root node in the given stack.
- * @st: Stack
- * @node: Node address in trie serialization
+ * get_node_path - Build a node path from the root node
+ * @node: Node id
+ * @buf:  Destination buffer
+ * @size: Buffer size
+ *
+ * The path is written backwards from the end of @buf while walking up to the
+ * root, a path longer than @buf loses its first components.
+ *
+ * Return: Start of the path in @buf
  */
-void get_node_path(struct stack *st, u8 * node)
+static char *get_node_path(unsigned long node, char *buf, size_t size)
 {
-	int ret;
-	if (!node) {
-		kerr("Given NULL pointer !!!");
-		return;
-	}
+	char *path = buf + size - 1;
+	const char *name;
+	size_t len;
 
-	while (strlen(get_node_filename(node)) != 0) {
-		klog("Add to stack : %s", get_node_filename(node));
+	*path = '\0';
 
-		ret = stack_push(st, get_node_filename(node));
-		if (ret) {
-			kerr("Failed to push node to stack");
-			return;
+	while (node != 0) {
+		name = get_node_filename(node);
+		len = strlen(name);
+
+		if (path - buf < len + 1) {
+			kerr("Path too long for %s", name);
+			break;
 		}
 
-		node = kallsyms_trie + get_node_parent(node);
+		path -= len;
+		memcpy(path, name, len);
+		*--path = '/';
+
+		node = get_node_parent(node);
 	}
+
+	return path;
 }
 
 /**
@@ -473,20 +597,23 @@ static int prepare_append_string(char **buffer, int buffer_size,
 /**
  * dump_node_stats - Print node path and amount of memory allocated by all
  *                   children
- * @node: Node address in trie serialization
+ * @node: Node id
  * @total: True if you want to summarize memory allocated by children or false
  *         for a dry print
  */
-static void dump_node_stats(u8 * node, bool total)
+static void dump_node_stats(unsigned long node, bool total)
 {
 	unsigned long mem_amount;
-	struct stack st;
-	u8 *temp;
+	const char *path;
 
 	if (total) {
+		if (node >= kallsyms_trie_num_nodes) {
+			kerr("Invalid node %lu !!!", node);
+			return;
+		}
 		mem_amount = get_node_value(node);
 	} else {
-		mem_amount = *(unsigned long *)node;
+		mem_amount = get_node_allocated(node);
 	}
 
 	if (*get_node_filename(node) == '\0') {
@@ -498,23 +625,13 @@ static void dump_node_stats(u8 * node, bool total)
 	sprintf(buffer + buffer_size, "%10lu\t", mem_amount);
 	buffer_size += 11;
 
-	stack_init(&st, DEFAULT_STACK_SIZE);
-	get_node_path(&st, node);
-
-	while (!stack_empty(&st)) {
-		temp = stack_pop(&st);
-		buffer_capacity = prepare_append_string(&buffer, buffer_size,
-							buffer_capacity,
-							strlen(temp) + 2);
-		sprintf(buffer + buffer_size, "/%s", temp);
-		buffer_size += strlen(temp) + 1;
-	}
-	stack_destroy(&st);
+	path = get_node_path(node, path_buffer, sizeof(path_buffer));
 
 	buffer_capacity = prepare_append_string(&buffer, buffer_size,
-						buffer_capacity, 2);
-	sprintf(buffer + buffer_size, "\n");
-	buffer_size += 1;
+						buffer_capacity,
+						strlen(path) + 2);
+	sprintf(buffer + buffer_size, "%s\n", path);
+	buffer_size += strlen(path) + 1;
 }
 
 /**
@@ -525,7 +642,8 @@ static void dump_module(struct module *mod)
 {
 	buffer_capacity = prepare_append_string(&buffer, buffer_size,
 						buffer_capacity, 12);
-	sprintf(buffer + buffer_size, "%10ld\t", mod->allocated_size);
+	sprintf(buffer + buffer_size, "%10ld\t",
+		atomic_long_read(&mod->allocated_size));
 	buffer_size += 11;
 
 	buffer_capacity = prepare_append_string(&buffer, buffer_size,
@@ -535,149 +653,889 @@ static void dump_module(struct module *mod)
 	buffer_size += strlen(mod->name) + 10;
 }
 
+/**
+ * dump_node_pages - Print node path and amount of memory it took from the page
+ *                   allocator, nothing if it took none
+ * @node:  Node id
+ * @noted: Set once the overlap note preceding the first line is printed
+ *
+ * The [pages] lines overlap the object lines @see get_node_pages, a note says
+ * so before the first of them.
+ */
+static void dump_node_pages(unsigned long node, bool *noted)
+{
+	static const char note[] =
+		"# [pages] include the vmalloc and percpu pages, "
+		"also counted as objects\n";
+	long mem_amount = get_node_pages(node);
+	const char *path;
+
+	if (mem_amount == 0)
+		return;
+
+	if (!*noted) {
+		buffer_capacity = prepare_append_string(&buffer, buffer_size,
+							buffer_capacity,
+							sizeof(note));
+		strcpy(buffer + buffer_size, note);
+		buffer_size += sizeof(note) - 1;
+		*noted = true;
+	}
+
+	buffer_capacity = prepare_append_string(&buffer, buffer_size,
+						buffer_capacity, 12);
+	sprintf(buffer + buffer_size, "%10ld\t", mem_amount);
+	buffer_size += 11;
+
+	path = get_node_path(node, path_buffer, sizeof(path_buffer));
+
+	buffer_capacity = prepare_append_string(&buffer, buffer_size,
+						buffer_capacity,
+						strlen(path) + 10);
+	sprintf(buffer + buffer_size, "%s\t[pages]\n", path);
+	buffer_size += strlen(path) + 9;
+}
+
 /**
  * dump_all - Print all available statistics on dynamic memory allocation
  */
 static void dump_all(void)
 {
 	struct module *mod;
-	int i;
+	bool noted = false;
+	unsigned long i;
+
+	for (i = 0; i < kallsyms_trie_num_nodes; i++) {
+		dump_node_stats(kallsyms_trie_index[i], false);
+	}
 
-	for (i = 0; i < db.size; i++) {
-		dump_node_stats(db.data[i] - sizeof(unsigned long), false);
+	for (i = 0; i < kallsyms_trie_num_nodes; i++) {
+		dump_node_pages(kallsyms_trie_index[i], &noted);
 	}
 
 	mutex_lock(&module_mutex);
 
 	list_for_each_entry(mod, &modules, list) {
 		dump_module(mod);
-		klog("Name %s size = %ld", mod->name, mod->allocated_size);
+		klog("Name %s size = %ld", mod->name,
+		     atomic_long_read(&mod->allocated_size));
 	}
 	mutex_unlock(&module_mutex);
 }
 
 /**
- * apply_filter - Dump all whose names match with given filename
- * @filename: Filter filename
+ * dump_tree - Print the memory allocated by every subtree up to a depth, like
+ *             "du -d" does for directories
+ * @m:     Sequence file
+ * @depth: Maximum depth, the top level directories have depth 1
+ *
+ * All the totals are computed in one pass, then the nodes are printed in DFS
+ * order without any allocation.
  */
-static void apply_filter(char *filename)
+static void dump_tree(struct seq_file *m, unsigned long depth)
 {
-	u8 **key;
-	int i, index;
 	struct module *mod;
+	unsigned long node = 0;
+	unsigned long level = 0;
 
-	/* Search filename over modules ... */
-	mutex_lock(&module_mutex);
+	compute_totals();
 
-	list_for_each_entry(mod, &modules, list) {
-		if (strcmp(mod->name, filename) == 0) {
-			dump_module(mod);
+	for (;;) {
+		if (node != 0)
+			seq_printf(m, "%10ld\t%s\n", totals[node],
+				   get_node_path(node, path_buffer,
+						 sizeof(path_buffer)));
+
+		if (level < depth && get_node_children_num(node) != 0) {
+			node = get_node_children(node);
+			level++;
+			continue;
 		}
-		klog("Name %s size = %ld\n", mod->name, mod->allocated_size);
-	}
-	mutex_unlock(&module_mutex);
 
-	/* Kernel search */
-	key = bsearch(&filename, db.data, db.size, sizeof(*db.data), db_cmp);
+		while (node != 0 && !get_node_next_sibling(node)) {
+			node = get_node_parent(node);
+			level--;
+		}
 
-	if (!key) {
-		klog("Could not found element '%s' through kernel files\n",
-		     filename);
-		return;
-	}
+		if (node == 0)
+			break;
 
-	index = key - db.data;
-	klog("File %s parent = %lu index = %d", *key,
-	     get_node_parent(*key - sizeof(unsigned long)), key - db.data);
+		node = get_node_next_sibling(node);
+	}
 
-	dump_node_stats(*key - sizeof(unsigned long), true);
+	mutex_lock(&module_mutex);
+	list_for_each_entry(mod, &modules, list) {
+		seq_printf(m, "%10ld\t%s\t[module]\n",
+			   atomic_long_read(&mod->allocated_size), mod->name);
+	}
+	mutex_unlock(&module_mutex);
+}
 
-	for (i = index - 1; i >= 0; i--) {
-		if (strcmp(db.data[i], filename) == 0) {
-			klog("Left %s parent = %lu index = %d", db.data[i],
-			     get_node_parent(db.data[i] -
-					     sizeof(unsigned long)), i);
+/**
+ * find_module_mark - Find the mark of a module
+ * @name: Module name
+ *
+ * Returns NULL if the module was not loaded at the last mark.
+ */
+static struct module_mark *find_module_mark(const char *name)
+{
+	unsigned int i;
 
-			dump_node_stats(db.data[i] - sizeof(unsigned long),
-					true);
-		} else {
-			break;
+	for (i = 0; i < module_marks_num; i++) {
+		if (strcmp(module_marks[i].name, name) == 0) {
+			return &module_marks[i];
 		}
 	}
 
-	for (i = index + 1; i < db.size; i++) {
-		if (strcmp(db.data[i], filename) == 0) {
-			klog("Right %s parent = %lu index = %d", db.data[i],
-			     get_node_parent(db.data[i] -
-					     sizeof(unsigned long)), i);
-			dump_node_stats(db.data[i] - sizeof(unsigned long),
-					true);
-		} else {
-			break;
-		}
-	}
+	return NULL;
 }
 
 /**
- * set_filter - Read procesure for proc_entry.
- * @file:    File handle
- * @buffer:  Source buffer
- * @count:   Buffer size
- * @data:
+ * take_mark - Save the memory allocated by each node and module
  *
- * This is the single way to set filter from userspace
+ * The next reports in delta mode are relative to this mark.
  */
-static int set_filter(struct file *file, const char __user * buffer,
-		      unsigned long count, void *data)
+static int take_mark(void)
 {
+	struct module_mark *marks;
+	struct module *mod;
+	unsigned long node;
+	unsigned int num = 0;
 
-	if (filter != NULL) {
-		kfree(filter);
-		filter = NULL;
+	mutex_lock(&report_mutex);
+	mutex_lock(&module_mutex);
+
+	list_for_each_entry(mod, &modules, list) {
+		num++;
 	}
 
-	filter = kmalloc(count, GFP_KERNEL);
-	if (!filter) {
+	marks = kmalloc(sizeof(*marks) * num, GFP_KERNEL);
+	if (!marks) {
+		mutex_unlock(&module_mutex);
+		mutex_unlock(&report_mutex);
 		kerr("Unable to alloc memory with kmalloc");
 		return -ENOMEM;
 	}
 
-	if (copy_from_user(filter, buffer, count)) {
-		kerr("copy_from_)user failed");
-		return -EFAULT;
+	for (node = 0; node < kallsyms_trie_num_nodes; node++) {
+		baseline[node] = get_node_allocated(node);
 	}
 
-	/* Remove the '\n' */
-	if (filter[count - 1] == '\n') {
-		filter[count - 1] = '\0';
+	num = 0;
+	list_for_each_entry(mod, &modules, list) {
+		strlcpy(marks[num].name, mod->name, sizeof(marks[num].name));
+		marks[num].allocated = atomic_long_read(&mod->allocated_size);
+		marks[num].seen = false;
+		num++;
 	}
 
-	if (strcmp(filter, "ALL") == 0) {
-		klog("Print all ... ");
-		kfree(filter);
-		filter = NULL;
-	}
+	mutex_unlock(&module_mutex);
 
-	klog("Count = %ld Filter : --%s--", count, filter);
+	kfree(module_marks);
+	module_marks = marks;
+	module_marks_num = num;
 
-	return count;
+	mutex_unlock(&report_mutex);
+
+	return 0;
 }
 
-static int dump_read(char *page, char **start, off_t off,
-		     int count, int *eof, void *data)
+static int compare_delta(const void *a, const void *b)
 {
-	int len = min(count, (int)(buffer_size - off));
+	long delta_a = abs(((const struct delta_entry *)a)->delta);
+	long delta_b = abs(((const struct delta_entry *)b)->delta);
 
-	if (buffer == NULL && off == 0) {
-		buffer = kmalloc(DEFAULT_DB_SIZE, GFP_KERNEL);
+	if (delta_a != delta_b) {
+		return delta_a > delta_b ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/**
+ * dump_delta - Print the nodes and modules changed since the last mark
+ * @m: Output file
+ *
+ * Each line holds the change, the current value and the file path or module
+ * name, sorted by the absolute value of the change. Modules unloaded since
+ * the mark are reported with a value of 0.
+ */
+static void dump_delta(struct seq_file *m)
+{
+	struct delta_entry *entries;
+	struct module_mark *mark;
+	struct module *mod;
+	unsigned long node, num = 0, changed = 0, capacity;
+	unsigned int i;
+	long value;
+
+	mutex_lock(&module_mutex);
+
+	for (node = 1; node < kallsyms_trie_num_nodes; node++) {
+		if (get_node_allocated(node) != baseline[node]) {
+			changed++;
+		}
+	}
+
+	capacity = changed + module_marks_num;
+	list_for_each_entry(mod, &modules, list) {
+		capacity++;
+	}
+
+	entries = vmalloc(sizeof(*entries) * max(capacity, 1UL));
+	if (!entries) {
+		mutex_unlock(&module_mutex);
+		kerr("Unable to allocate memory with vmalloc");
+		return;
+	}
+
+	/* Counters keep changing, nodes changed after the count are skipped */
+	for (node = 1; node < kallsyms_trie_num_nodes && num < changed; node++) {
+		value = get_node_allocated(node);
+		if (value == baseline[node]) {
+			continue;
+		}
+
+		entries[num].delta = value - baseline[node];
+		entries[num].value = value;
+		entries[num].node = node;
+		entries[num].module = NULL;
+		num++;
+	}
+
+	for (i = 0; i < module_marks_num; i++) {
+		module_marks[i].seen = false;
+	}
+
+	list_for_each_entry(mod, &modules, list) {
+		mark = find_module_mark(mod->name);
+		value = atomic_long_read(&mod->allocated_size) -
+			(mark ? mark->allocated : 0);
+		if (mark) {
+			mark->seen = true;
+		}
+
+		if (value != 0) {
+			entries[num].delta = value;
+			entries[num].value = atomic_long_read(&mod->allocated_size);
+			entries[num].module = mod->name;
+			num++;
+		}
+	}
+
+	for (i = 0; i < module_marks_num; i++) {
+		if (!module_marks[i].seen && module_marks[i].allocated != 0) {
+			entries[num].delta = -module_marks[i].allocated;
+			entries[num].value = 0;
+			entries[num].module = module_marks[i].name;
+			num++;
+		}
+	}
+
+	sort(entries, num, sizeof(*entries), compare_delta, NULL);
+
+	for (i = 0; i < num; i++) {
+		if (entries[i].module) {
+			seq_printf(m, "%+11ld\t%10ld\t%s\t[module]\n",
+				   entries[i].delta, entries[i].value,
+				   entries[i].module);
+		} else {
+			seq_printf(m, "%+11ld\t%10ld\t%s\n",
+				   entries[i].delta, entries[i].value,
+				   get_node_path(entries[i].node, path_buffer,
+						 sizeof(path_buffer)));
+		}
+	}
+
+	mutex_unlock(&module_mutex);
+
+	vfree(entries);
+}
+
+/**
+ * dump_slack - Print the internal fragmentation of each file and module
+ * @m: Output file
+ *
+ * Each line holds the bytes requested, the bytes used, their difference in
+ * percents of the bytes used and the file path or module name, sorted by the
+ * wasted bytes.
+ */
+static void dump_slack(struct seq_file *m)
+{
+	struct delta_entry *entries;
+	struct module *mod;
+	unsigned long node, num = 0, capacity;
+	unsigned long i;
+	long requested;
+
+	mutex_lock(&module_mutex);
+
+	capacity = kallsyms_trie_num_nodes;
+	list_for_each_entry(mod, &modules, list) {
+		capacity++;
+	}
+
+	entries = vmalloc(sizeof(*entries) * capacity);
+	if (!entries) {
+		mutex_unlock(&module_mutex);
+		kerr("Unable to allocate memory with vmalloc");
+		return;
+	}
+
+	for (node = 1; node < kallsyms_trie_num_nodes; node++) {
+		if (get_node_allocated(node) == 0) {
+			continue;
+		}
+
+		entries[num].value = get_node_allocated(node);
+		entries[num].delta = entries[num].value -
+				     get_node_requested(node);
+		entries[num].node = node;
+		entries[num].module = NULL;
+		num++;
+	}
+
+	list_for_each_entry(mod, &modules, list) {
+		if (atomic_long_read(&mod->allocated_size) == 0) {
+			continue;
+		}
+
+		entries[num].value = atomic_long_read(&mod->allocated_size);
+		entries[num].delta = entries[num].value -
+				     atomic_long_read(&mod->requested_size);
+		entries[num].module = mod->name;
+		num++;
+	}
+
+	sort(entries, num, sizeof(*entries), compare_delta, NULL);
+
+	for (i = 0; i < num; i++) {
+		requested = entries[i].value - entries[i].delta;
+		seq_printf(m, "%10ld\t%10ld\t%3ld%%\t", requested,
+			   entries[i].value,
+			   entries[i].delta * 100 / entries[i].value);
+
+		if (entries[i].module) {
+			seq_printf(m, "%s\t[module]\n", entries[i].module);
+		} else {
+			seq_printf(m, "%s\n",
+				   get_node_path(entries[i].node, path_buffer,
+						 sizeof(path_buffer)));
+		}
+	}
+
+	mutex_unlock(&module_mutex);
+
+	vfree(entries);
+}
+
+static int compare_cache_pair(const void *a, const void *b)
+{
+	const struct cache_entry *x = a, *y = b;
+	int ret = strcmp(x->name, y->name);
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (x->node != y->node) {
+		return x->node < y->node ? -1 : 1;
+	}
+
+	return 0;
+}
+
+static int compare_cache_size(const void *a, const void *b)
+{
+	const struct cache_entry *x = a, *y = b;
+	int ret = strcmp(x->name, y->name);
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (x->size != y->size) {
+		return x->size > y->size ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/**
+ * dump_caches - Print the slab memory of each kmem_cache and file pair
+ * @m: Output file
+ *
+ * Each line holds the bytes, the objects, the cache name and the file path,
+ * grouped by cache and sorted by bytes. Only the cache_filter cache is
+ * printed if it is set.
+ */
+static void dump_caches(struct seq_file *m)
+{
+	struct kallsyms_cache_slot *slot;
+	struct cache_entry *entries;
+	unsigned long i, num = 0, k;
+	long overflow;
+
+	entries = vmalloc(sizeof(*entries) * KALLSYMS_CACHE_SLOTS);
+	if (!entries) {
+		kerr("Unable to allocate memory with vmalloc");
+		return;
+	}
+
+	for (i = 0; i < KALLSYMS_CACHE_SLOTS; i++) {
+		slot = &kallsyms_cache_slots[i];
+		if (atomic_read(&slot->state) != KALLSYMS_SLOT_READY) {
+			continue;
+		}
+		smp_rmb();
+
+		if (cache_filter[0] != '\0' &&
+		    strcmp(slot->name, cache_filter) != 0) {
+			continue;
+		}
+
+		entries[num].name = slot->name;
+		entries[num].node = slot->node;
+		entries[num].size = atomic_long_read(&kallsyms_cache_sizes[i]);
+		entries[num].count = atomic_long_read(&kallsyms_cache_counts[i]);
+		num++;
+	}
+
+	/* Add up the slots of the same pair */
+	sort(entries, num, sizeof(*entries), compare_cache_pair, NULL);
+	for (i = 0, k = 0; i < num; i++) {
+		if (k > 0 && compare_cache_pair(&entries[k - 1],
+						&entries[i]) == 0) {
+			entries[k - 1].size += entries[i].size;
+			entries[k - 1].count += entries[i].count;
+		} else {
+			entries[k++] = entries[i];
+		}
+	}
+	num = k;
+
+	sort(entries, num, sizeof(*entries), compare_cache_size, NULL);
+
+	for (i = 0; i < num; i++) {
+		if (entries[i].size == 0 && entries[i].count == 0) {
+			continue;
+		}
+
+		seq_printf(m, "%10ld\t%8ld\t%s\t%s\n", entries[i].size,
+			   entries[i].count, entries[i].name,
+			   entries[i].node ?
+			   get_node_path(entries[i].node, path_buffer,
+					 sizeof(path_buffer)) : "[module]");
+	}
+
+	overflow = atomic_long_read(&kallsyms_cache_overflow);
+	if (cache_filter[0] == '\0' && overflow != 0) {
+		seq_printf(m, "%10ld\t%8s\t[overflow]\n", overflow, "-");
+	}
+
+	vfree(entries);
+}
+
+/**
+ * dump_numa - Print the memory of each file on each NUMA node
+ * @m: Output file
+ *
+ * Each line holds one column per NUMA node and the file path, or only the
+ * numa_filter column if it is set. Files without memory in the printed
+ * columns are skipped.
+ */
+static void dump_numa(struct seq_file *m)
+{
+	atomic_long_t *numa = ACCESS_ONCE(kallsyms_trie_numa);
+	unsigned long i, node;
+	long value, any;
+	int nid;
+
+	if (!numa) {
+		return;
+	}
+
+	for (i = 0; i < kallsyms_trie_num_nodes; i++) {
+		node = kallsyms_trie_index[i];
+
+		any = 0;
+		for (nid = 0; nid < nr_node_ids; nid++) {
+			if (numa_filter < 0 || nid == numa_filter) {
+				any |= atomic_long_read(&numa[node *
+								nr_node_ids +
+								nid]);
+			}
+		}
+
+		if (any == 0) {
+			continue;
+		}
+
+		for (nid = 0; nid < nr_node_ids; nid++) {
+			if (numa_filter < 0 || nid == numa_filter) {
+				value = atomic_long_read(&numa[node *
+							       nr_node_ids +
+							       nid]);
+				seq_printf(m, "%10ld\t", value);
+			}
+		}
+		seq_printf(m, "%s\n", get_node_path(node, path_buffer,
+						    sizeof(path_buffer)));
+	}
+}
+
+/**
+ * dump_chains - Print the memory of each call chain in the folded format
+ * @m: Output file
+ *
+ * Each line holds the callers from the outermost to the innermost, separated
+ * by ';', and the bytes still allocated from the chain. flamegraph.pl takes
+ * it as it is. The bytes allocated while the chain table was full are printed
+ * last, as an [overflow] chain of their own.
+ */
+static void dump_chains(struct seq_file *m)
+{
+	struct kallsyms_chain *chains = ACCESS_ONCE(kallsyms_chains);
+	struct kallsyms_chain *chain;
+	unsigned long i;
+	long value;
+	int cpu, depth;
+
+	if (!chains) {
+		klog("Call chains are not recorded");
+		return;
+	}
+
+	for (i = 0; i < KALLSYMS_CHAIN_SLOTS; i++) {
+		chain = &chains[i];
+		if (atomic_read(&chain->state) != KALLSYMS_SLOT_READY) {
+			continue;
+		}
+		smp_rmb();
+
+		value = 0;
+		for_each_possible_cpu(cpu) {
+			value += *per_cpu_ptr(kallsyms_chain_sizes + i, cpu);
+		}
+
+		if (value <= 0) {
+			continue;
+		}
+
+		for (depth = chain->depth - 1; depth >= 0; depth--) {
+			seq_printf(m, "%ps%c", (void *)chain->entries[depth],
+				   depth ? ';' : ' ');
+		}
+		seq_printf(m, "%ld\n", value);
+	}
+
+	value = atomic_long_read(&kallsyms_chain_overflow);
+	if (value != 0) {
+		seq_printf(m, "[overflow] %ld\n", value);
+	}
+}
+
+/**
+ * reset_peaks - Start a new peak and lifetime measurement
+ *
+ * The peaks are lowered to the current values and the lifetime histograms are
+ * cleared.
+ */
+static void reset_peaks(void)
+{
+	struct module *mod;
+	unsigned long node, i;
+
+	for (node = 0; node < kallsyms_trie_num_nodes; node++) {
+		atomic_long_set(&kallsyms_trie_peaks[node],
+				get_node_allocated(node));
+		for (i = 0; i < KALLSYMS_LIFETIME_BUCKETS; i++) {
+			atomic_set(get_node_lifetimes(node) + i, 0);
+		}
+	}
+
+	mutex_lock(&module_mutex);
+	list_for_each_entry(mod, &modules, list) {
+		atomic_long_set(&mod->allocated_peak,
+				atomic_long_read(&mod->allocated_size));
+	}
+	mutex_unlock(&module_mutex);
+}
+
+/**
+ * dump_peaks - Print the current and peak memory of each file and module
+ * @m: Output file
+ *
+ * Files which never allocated memory are skipped.
+ */
+static void dump_peaks(struct seq_file *m)
+{
+	struct module *mod;
+	unsigned long i, node;
+
+	for (i = 0; i < kallsyms_trie_num_nodes; i++) {
+		node = kallsyms_trie_index[i];
+		if (get_node_peak(node) == 0) {
+			continue;
+		}
+
+		seq_printf(m, "%10ld\t%10ld\t%s\n", get_node_allocated(node),
+			   get_node_peak(node),
+			   get_node_path(node, path_buffer,
+					 sizeof(path_buffer)));
+	}
+
+	mutex_lock(&module_mutex);
+	list_for_each_entry(mod, &modules, list) {
+		seq_printf(m, "%10ld\t%10ld\t%s\t[module]\n",
+			   atomic_long_read(&mod->allocated_size),
+			   atomic_long_read(&mod->allocated_peak), mod->name);
+	}
+	mutex_unlock(&module_mutex);
+}
+
+/**
+ * dump_lifetimes - Print the lifetime histogram of each file
+ * @m: Output file
+ *
+ * Each line holds KALLSYMS_LIFETIME_BUCKETS counters and the file path,
+ * counter 0 is the number of objects freed in the jiffy they were allocated
+ * and counter i the number of objects which lived 2^(i-1) to 2^i - 1
+ * jiffies. Files which freed nothing are skipped.
+ */
+static void dump_lifetimes(struct seq_file *m)
+{
+	unsigned long i, node, frees;
+	atomic_t *lifetimes;
+	unsigned int k;
+
+	for (i = 0; i < kallsyms_trie_num_nodes; i++) {
+		node = kallsyms_trie_index[i];
+		lifetimes = get_node_lifetimes(node);
+
+		frees = 0;
+		for (k = 0; k < KALLSYMS_LIFETIME_BUCKETS; k++) {
+			frees += atomic_read(lifetimes + k);
+		}
+
+		if (frees == 0) {
+			continue;
+		}
+
+		for (k = 0; k < KALLSYMS_LIFETIME_BUCKETS; k++) {
+			seq_printf(m, "%u\t", atomic_read(lifetimes + k));
+		}
+		seq_printf(m, "%s\n", get_node_path(node, path_buffer,
+						    sizeof(path_buffer)));
+	}
+}
+
+/**
+ * apply_filter - Dump all whose names match with given filename
+ * @filename: Filter filename
+ */
+static void apply_filter(char *filename)
+{
+	unsigned long i, index;
+	struct module *mod;
+	bool noted = false;
+
+	/* Search filename over modules ... */
+	mutex_lock(&module_mutex);
+
+	list_for_each_entry(mod, &modules, list) {
+		if (strcmp(mod->name, filename) == 0) {
+			dump_module(mod);
+		}
+		klog("Name %s size = %ld\n", mod->name,
+		     atomic_long_read(&mod->allocated_size));
+	}
+	mutex_unlock(&module_mutex);
+
+	/* Kernel search */
+	index = find_first_file(filename);
+
+	if (index == kallsyms_trie_num_nodes) {
+		klog("Could not found element '%s' through kernel files\n",
+		     filename);
+		return;
+	}
+
+	/* Nodes with the same name are adjacent in kallsyms_trie_index */
+	for (i = index; i < kallsyms_trie_num_nodes; i++) {
+		if (strcmp(get_node_filename(kallsyms_trie_index[i]),
+			   filename) != 0)
+			break;
+
+		klog("File %s parent = %lu index = %lu", filename,
+		     get_node_parent(kallsyms_trie_index[i]), i);
+
+		dump_node_stats(kallsyms_trie_index[i], true);
+		dump_node_pages(kallsyms_trie_index[i], &noted);
+	}
+}
+
+/**
+ * set_filter - Read procesure for proc_entry.
+ * @file:    File handle
+ * @buffer:  Source buffer
+ * @count:   Buffer size
+ * @data:
+ *
+ * This is the single way to set filter from userspace
+ */
+static int set_filter(struct file *file, const char __user * buffer,
+		      unsigned long count, void *data)
+{
+	char command[16], *new_filter;
+	unsigned long depth;
+	int err, nid;
+
+	/* A mark or a reset keeps the current report mode */
+	if (count > 0 && count < sizeof(command)) {
+		if (copy_from_user(command, buffer, count)) {
+			return -EFAULT;
+		}
+		command[count] = '\0';
+
+		if (command[count - 1] == '\n') {
+			command[count - 1] = '\0';
+		}
+
+		if (strcmp(command, MARK_COMMAND) == 0) {
+			klog("Mark ... ");
+			err = take_mark();
+			return err ? err : count;
+		}
+
+		if (strcmp(command, RESET_COMMAND) == 0) {
+			klog("Reset peaks ... ");
+			reset_peaks();
+			return count;
+		}
+	}
+
+	new_filter = kmalloc(count + 1, GFP_KERNEL);
+	if (!new_filter) {
+		kerr("Unable to alloc memory with kmalloc");
+		return -ENOMEM;
+	}
+
+	if (copy_from_user(new_filter, buffer, count)) {
+		kerr("copy_from_user failed");
+		kfree(new_filter);
+		return -EFAULT;
+	}
+	new_filter[count] = '\0';
+
+	/* Remove the '\n' */
+	if (count > 0 && new_filter[count - 1] == '\n') {
+		new_filter[count - 1] = '\0';
+	}
+
+	/* A rejected command leaves the report as it was */
+	if (sscanf(new_filter, NUMA_COMMAND " %d", &nid) == 1 &&
+	    (nid < 0 || nid >= nr_node_ids)) {
+		kerr("Invalid NUMA node %d", nid);
+		kfree(new_filter);
+		return -EINVAL;
+	}
+
+	/* The report settings are read under it by dump_read and lkma_show */
+	mutex_lock(&report_mutex);
+
+	kfree(filter);
+	filter = new_filter;
+	report_mode = REPORT_FILES;
+
+	if (strcmp(filter, "ALL") == 0) {
+		klog("Print all ... ");
+		kfree(filter);
+		filter = NULL;
+	} else if (sscanf(filter, DEPTH_COMMAND " %lu", &depth) == 1) {
+		klog("Print tree up to depth %lu ... ", depth);
+		report_depth = depth;
+		if (report_depth != 0) {
+			report_mode = REPORT_TREE;
+		}
+		kfree(filter);
+		filter = NULL;
+	} else if (strcmp(filter, DELTA_COMMAND) == 0) {
+		klog("Print changes since the last mark ... ");
+		report_mode = REPORT_DELTA;
+		kfree(filter);
+		filter = NULL;
+	} else if (strcmp(filter, PEAK_COMMAND) == 0) {
+		klog("Print peaks ... ");
+		report_mode = REPORT_PEAKS;
+		kfree(filter);
+		filter = NULL;
+	} else if (strcmp(filter, LIFETIME_COMMAND) == 0) {
+		klog("Print lifetimes ... ");
+		report_mode = REPORT_LIFETIMES;
+		kfree(filter);
+		filter = NULL;
+	} else if (strncmp(filter, CACHES_COMMAND,
+			   sizeof(CACHES_COMMAND) - 1) == 0 &&
+		   (filter[sizeof(CACHES_COMMAND) - 1] == '\0' ||
+		    filter[sizeof(CACHES_COMMAND) - 1] == ' ')) {
+		klog("Print caches ... ");
+		report_mode = REPORT_CACHES;
+		cache_filter[0] = '\0';
+		if (filter[sizeof(CACHES_COMMAND) - 1] == ' ') {
+			strlcpy(cache_filter, filter + sizeof(CACHES_COMMAND),
+				sizeof(cache_filter));
+		}
+		kfree(filter);
+		filter = NULL;
+	} else if (sscanf(filter, NUMA_COMMAND " %d", &nid) == 1) {
+		klog("Print NUMA node %d ... ", nid);
+		report_mode = REPORT_NUMA;
+		numa_filter = nid;
+		kfree(filter);
+		filter = NULL;
+	} else if (strcmp(filter, NUMA_COMMAND) == 0) {
+		klog("Print NUMA nodes ... ");
+		report_mode = REPORT_NUMA;
+		numa_filter = -1;
+		kfree(filter);
+		filter = NULL;
+	} else if (strcmp(filter, CHAINS_COMMAND) == 0) {
+		klog("Print call chains ... ");
+		report_mode = REPORT_CHAINS;
+		kfree(filter);
+		filter = NULL;
+	} else if (strcmp(filter, SLACK_COMMAND) == 0) {
+		klog("Print slack ... ");
+		report_mode = REPORT_SLACK;
+		kfree(filter);
+		filter = NULL;
+	}
+
+	klog("Count = %ld Filter : --%s--", count, filter);
+	mutex_unlock(&report_mutex);
+
+	return count;
+}
+
+static int dump_read(char *page, char **start, off_t off,
+		     int count, int *eof, void *data)
+{
+	int len = min(count, (int)(buffer_size - off));
+
+	if (buffer == NULL && off == 0) {
+		buffer = kmalloc(DEFAULT_DB_SIZE, GFP_KERNEL);
 		buffer_capacity = DEFAULT_DB_SIZE;
 		buffer_size = 0;
 
+		mutex_lock(&report_mutex);
+		start_report();
 		if (filter != NULL) {
 			apply_filter(filter);
 		} else {
 			dump_all();
 		}
+		mutex_unlock(&report_mutex);
 		len = min(count, buffer_size);
 	}
 	*start = page;
@@ -700,10 +1558,50 @@ static int dump_read(char *page, char **start, off_t off,
 
 static int lkma_show(struct seq_file *m, void *v)
 {
+	mutex_lock(&report_mutex);
+
+	switch (report_mode) {
+	case REPORT_TREE:
+		dump_tree(m, report_depth);
+		mutex_unlock(&report_mutex);
+		return 0;
+	case REPORT_DELTA:
+		dump_delta(m);
+		mutex_unlock(&report_mutex);
+		return 0;
+	case REPORT_PEAKS:
+		dump_peaks(m);
+		mutex_unlock(&report_mutex);
+		return 0;
+	case REPORT_LIFETIMES:
+		dump_lifetimes(m);
+		mutex_unlock(&report_mutex);
+		return 0;
+	case REPORT_SLACK:
+		dump_slack(m);
+		mutex_unlock(&report_mutex);
+		return 0;
+	case REPORT_CACHES:
+		dump_caches(m);
+		mutex_unlock(&report_mutex);
+		return 0;
+	case REPORT_NUMA:
+		dump_numa(m);
+		mutex_unlock(&report_mutex);
+		return 0;
+	case REPORT_CHAINS:
+		dump_chains(m);
+		mutex_unlock(&report_mutex);
+		return 0;
+	default:
+		break;
+	}
+
 	buffer = kmalloc(DEFAULT_DB_SIZE, GFP_KERNEL);
 	buffer_capacity = DEFAULT_DB_SIZE;
 	buffer_size = 0;
 
+	start_report();
 	if (filter != NULL) {
 		apply_filter(filter);
 	} else {
@@ -717,6 +1615,8 @@ static int lkma_show(struct seq_file *m, void *v)
 		buffer = NULL;
 	}
 
+	mutex_unlock(&report_mutex);
+
 	return 0;
 }
 
@@ -734,26 +1634,429 @@ static const struct file_operations lkma_fops = {
 	.write = set_filter,
 };
 
+/**
+ * put_varint - Encode an unsigned value as a LEB128 varint
+ * @p:     Destination, at least MAX_VARINT_LEN bytes long
+ * @value: Value to encode
+ *
+ * Returns the first byte after the encoded value.
+ */
+static u8 *put_varint(u8 *p, u64 value)
+{
+	while (value >= 0x80) {
+		*p++ = (u8)value | 0x80;
+		value >>= 7;
+	}
+	*p++ = (u8)value;
+
+	return p;
+}
+
+/**
+ * zigzag - Map a signed value to an unsigned one with small magnitudes first
+ * @value: Value to map
+ */
+static u64 zigzag(long value)
+{
+	return ((u64)value << 1) ^ (u64)(value >> (BITS_PER_LONG - 1));
+}
+
+/**
+ * unzigzag - Inverse of zigzag
+ * @value: Value to map
+ */
+static long unzigzag(u64 value)
+{
+	return (long)(value >> 1) ^ -(long)(value & 1);
+}
+
+/**
+ * history_get_varint - Decode a varint from the history ring
+ * @off: Ring offset of the varint, advanced past it
+ */
+static u64 history_get_varint(size_t *off)
+{
+	unsigned int shift = 0;
+	u64 value = 0;
+	u8 byte;
+
+	do {
+		byte = history[*off];
+		*off = (*off + 1) % history_capacity;
+		value |= (u64)(byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	return value;
+}
+
+/**
+ * history_write - Append bytes to the history ring
+ * @data: Bytes to append
+ * @len:  Number of bytes, there must be room for them
+ */
+static void history_write(const u8 *data, size_t len)
+{
+	size_t chunk = min(len, history_capacity - history_head);
+
+	memcpy(history + history_head, data, chunk);
+	memcpy(history, data + chunk, len - chunk);
+	history_head = (history_head + len) % history_capacity;
+	history_used += len;
+}
+
+/**
+ * drop_frame - Fold the oldest frame of the history ring into history_base
+ */
+static void drop_frame(void)
+{
+	size_t off = history_tail;
+	unsigned long count, node = 0;
+
+	history_base_time += history_get_varint(&off);
+	count = history_get_varint(&off);
+	while (count--) {
+		node += history_get_varint(&off);
+		history_base[node] += unzigzag(history_get_varint(&off));
+	}
+
+	history_used -= (off + history_capacity - history_tail) % history_capacity;
+	history_tail = off;
+	history_frames--;
+	history_generation++;
+}
+
+/**
+ * take_sample - Append a frame with the nodes changed since the last one
+ *
+ * A frame is the time elapsed since the previous frame in milliseconds and
+ * the number of entries, followed by one entry per changed node: the node id
+ * as a gap from the previous entry and the change of its allocated memory,
+ * zigzag encoded. Every field is a varint, so a frame of a quiet system is a
+ * few bytes long. The oldest frames are folded into history_base to make
+ * room, nothing is recorded if no node changed.
+ */
+static void take_sample(void)
+{
+	u8 header[2 * MAX_VARINT_LEN], *end, *p = frame_buffer;
+	unsigned long node, prev = 0, count = 0;
+	s64 now = ktime_to_ms(ktime_get());
+	size_t header_len, len;
+	long value;
+
+	mutex_lock(&history_mutex);
+
+	for (node = 0; node < kallsyms_trie_num_nodes; node++) {
+		value = get_node_allocated(node);
+		if (value == history_last[node]) {
+			continue;
+		}
+
+		p = put_varint(p, node - prev);
+		p = put_varint(p, zigzag(value - history_last[node]));
+		history_last[node] = value;
+		prev = node;
+		count++;
+	}
+
+	if (count == 0) {
+		goto out;
+	}
+
+	end = put_varint(header, now - history_last_time);
+	end = put_varint(end, count);
+	header_len = end - header;
+	len = p - frame_buffer;
+	history_last_time = now;
+
+	/* A frame never fills the whole ring, so head == tail means empty */
+	if (header_len + len >= history_capacity) {
+		memcpy(history_base, history_last,
+		       sizeof(*history_base) * kallsyms_trie_num_nodes);
+		history_base_time = now;
+		history_head = history_tail = history_used = 0;
+		history_frames = 0;
+		history_generation++;
+		goto out;
+	}
+
+	while (history_capacity - history_used < header_len + len) {
+		drop_frame();
+	}
+
+	history_write(header, header_len);
+	history_write(frame_buffer, len);
+	history_frames++;
+
+out:
+	mutex_unlock(&history_mutex);
+}
+
+/**
+ * sampler_thread - Take a sample every sample_period milliseconds
+ * @data: Unused
+ */
+static int sampler_thread(void *data)
+{
+	while (!kthread_should_stop()) {
+		take_sample();
+		schedule_timeout_interruptible(msecs_to_jiffies(sample_period));
+	}
+
+	return 0;
+}
+
+/**
+ * history_cursor_reset - Rewind the cursor to the first history entry
+ * @c: Cursor
+ */
+static void history_cursor_reset(struct history_cursor *c)
+{
+	memcpy(history_replay, history_base,
+	       sizeof(*history_replay) * kallsyms_trie_num_nodes);
+
+	c->pos = 0;
+	c->generation = history_generation;
+	c->node = 0;
+	c->time = history_base_time;
+	c->off = history_tail;
+	c->frame = 0;
+	c->left = 0;
+	c->in_base = true;
+}
+
+/**
+ * history_cursor_next - Move the cursor to the next history entry
+ * @c: Cursor
+ *
+ * The first entries are the nonzero nodes of history_base, the following ones
+ * are replayed from the frames of the ring into history_replay. Returns false
+ * if there are no more entries.
+ */
+static bool history_cursor_next(struct history_cursor *c)
+{
+	unsigned long node;
+
+	if (c->in_base) {
+		node = c->pos ? c->node + 1 : 0;
+		while (node < kallsyms_trie_num_nodes &&
+		       history_base[node] == 0) {
+			node++;
+		}
+
+		if (node < kallsyms_trie_num_nodes) {
+			c->node = node;
+			c->delta = history_base[node];
+			c->pos++;
+			return true;
+		}
+
+		c->in_base = false;
+	}
+
+	while (c->left == 0) {
+		if (c->frame == history_frames) {
+			return false;
+		}
+
+		c->time += history_get_varint(&c->off);
+		c->left = history_get_varint(&c->off);
+		c->node = 0;
+		c->frame++;
+	}
+
+	c->node += history_get_varint(&c->off);
+	c->delta = unzigzag(history_get_varint(&c->off));
+	history_replay[c->node] += c->delta;
+	c->left--;
+	c->pos++;
+
+	return true;
+}
+
+static void *history_start(struct seq_file *m, loff_t *pos)
+{
+	struct history_cursor *c = &history_cursor;
+
+	mutex_lock(&history_mutex);
+
+	/* Entry *pos is the one the cursor returned last */
+	if (c->generation != history_generation || c->pos > *pos + 1) {
+		history_cursor_reset(c);
+	}
+
+	while (c->pos < *pos + 1) {
+		if (!history_cursor_next(c)) {
+			return NULL;
+		}
+	}
+
+	return c;
+}
+
+static void *history_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+
+	return history_cursor_next(v) ? v : NULL;
+}
+
+static void history_stop(struct seq_file *m, void *v)
+{
+	mutex_unlock(&history_mutex);
+}
+
+/**
+ * history_show - Print a history entry
+ *
+ * Each line holds the time in milliseconds since boot, the change of the
+ * memory allocated by a file, its new value and the path of the file.
+ */
+static int history_show(struct seq_file *m, void *v)
+{
+	struct history_cursor *c = v;
+
+	seq_printf(m, "%lld\t%+ld\t%ld\t%s\n", (long long)c->time, c->delta,
+		   history_replay[c->node],
+		   get_node_path(c->node, history_path, sizeof(history_path)));
+
+	return 0;
+}
+
+static const struct seq_operations history_seq_ops = {
+	.start = history_start,
+	.next = history_next,
+	.stop = history_stop,
+	.show = history_show,
+};
+
+static int history_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &history_seq_ops);
+}
+
+static const struct file_operations history_fops = {
+	.owner = THIS_MODULE,
+	.open = history_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release,
+};
+
+static void history_free(void)
+{
+	vfree(history);
+	vfree(history_base);
+	vfree(history_last);
+	vfree(history_replay);
+	vfree(frame_buffer);
+}
+
+/**
+ * history_init - Start the sampler if sample_period is set
+ */
+static int history_init(void)
+{
+	size_t nodes = kallsyms_trie_num_nodes;
+	int err;
+
+	if (sample_period == 0) {
+		return 0;
+	}
+
+	if (history_size == 0) {
+		kerr("history_size must not be 0");
+		return -EINVAL;
+	}
+
+	history_capacity = (size_t)history_size * 1024;
+	history = vmalloc(history_capacity);
+	history_base = vzalloc(sizeof(*history_base) * nodes);
+	history_last = vzalloc(sizeof(*history_last) * nodes);
+	history_replay = vmalloc(sizeof(*history_replay) * nodes);
+	frame_buffer = vmalloc(2 * MAX_VARINT_LEN * nodes);
+	if (!history || !history_base || !history_last || !history_replay ||
+	    !frame_buffer) {
+		kerr("Unable to allocate memory with vmalloc");
+		history_free();
+		return -ENOMEM;
+	}
+
+	history_base_time = history_last_time = ktime_to_ms(ktime_get());
+	history_cursor_reset(&history_cursor);
+
+	if (proc_create(HISTORY_FILENAME, 0, NULL, &history_fops) == NULL) {
+		kerr("Couldn't create proc entry");
+		history_free();
+		return -ENOMEM;
+	}
+
+	sampler = kthread_run(sampler_thread, NULL, "lkma_sampler");
+	if (IS_ERR(sampler)) {
+		err = PTR_ERR(sampler);
+		sampler = NULL;
+		remove_proc_entry(HISTORY_FILENAME, NULL);
+		history_free();
+		return err;
+	}
+
+	return 0;
+}
+
+static void history_exit(void)
+{
+	if (sampler == NULL) {
+		return;
+	}
+
+	kthread_stop(sampler);
+	remove_proc_entry(HISTORY_FILENAME, NULL);
+	history_free();
+}
+
 static int lkma_init(void)
 {
+	int err;
 
 	filter = NULL;
 
+	totals = vmalloc(sizeof(*totals) * kallsyms_trie_num_nodes);
+	cache = vzalloc(sizeof(*cache) * kallsyms_trie_num_nodes);
+	baseline = vzalloc(sizeof(*baseline) * kallsyms_trie_num_nodes);
+	if (!totals || !cache || !baseline) {
+		kerr("Unable to allocate memory with vmalloc");
+		vfree(totals);
+		vfree(cache);
+		vfree(baseline);
+		return -ENOMEM;
+	}
+
 	lkma_entry = proc_create(PROC_FILENAME, 0, NULL, &lkma_fops);
 
 	if (lkma_entry == NULL) {
 		klog("Couldn't create proc entry");
+		vfree(totals);
+		vfree(cache);
+		vfree(baseline);
 		return -ENOMEM;
 	}
 
-	build_db();
+	err = history_init();
+	if (err) {
+		remove_proc_entry(PROC_FILENAME, NULL);
+		vfree(totals);
+		vfree(cache);
+		vfree(baseline);
+		return err;
+	}
+
 	klog("Module loaded");
 	return 0;
 }
 
 static void lkma_exit(void)
 {
-	kfree(db.data);
+	history_exit();
 
 	if (filter != NULL) {
 		kfree(filter);
@@ -765,6 +2068,11 @@ static void lkma_exit(void)
 
 	remove_proc_entry(PROC_FILENAME, NULL);
 
+	vfree(totals);
+	vfree(cache);
+	vfree(baseline);
+	kfree(module_marks);
+
 	klog("Module unloaded");
 }
 
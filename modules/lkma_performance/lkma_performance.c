@@ -2,9 +2,24 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/percpu.h>
 #include <linux/list.h>
 #include <linux/jiffies.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/sort.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/irqflags.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/smp.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
 
 #include <linux/timex.h>
 
@@ -29,8 +44,15 @@ MODULE_LICENSE("GPL");
 
 #define LKMA_OOM		-2
 
+#define MAX_ITERATIONS		100000
+#define CALIBRATION_MS		20
+#define LINE_LEN		120
+#define RESULTS_FILENAME	"results"
+#define ALLOCATORS_FILENAME	"allocators"
+
 #if LKMA_PROCFS
 #define PROC_FILENAME		(THIS_MODULE->name)
+#define SCALE_FILENAME		"lkma_performance_scale"
 #else
 #define SYSFS_FILENAME		(THIS_MODULE->name)
 #endif
@@ -38,6 +60,8 @@ MODULE_LICENSE("GPL");
 #define VMALLOC_MAX_SIZE	(300 * MB)
 #undef KMALLOC_MAX_SIZE
 #define KMALLOC_MAX_SIZE	(4 * MB)
+#define PAGES_MAX_SIZE		(PAGE_SIZE << (MAX_ORDER - 1))
+#define PERCPU_MAX_SIZE		(32 * KB)
 #define DEFAULT_FLAGS_ID	0
 
 #define NUM_ALLOCATION		array_size(allocators)
@@ -70,8 +94,27 @@ enum {
 extern void *lkma_kernel_kmalloc(size_t size, gfp_t flags);
 extern void *lkma_kernel_kzalloc(size_t size, gfp_t flags);
 extern void *lkma_kernel_vmalloc(size_t size, gfp_t flags);
+extern void *lkma_kernel_kmem_cache_alloc(struct kmem_cache *cache,
+					  gfp_t flags);
+extern struct page *lkma_kernel_alloc_pages(gfp_t flags, unsigned int order);
+extern void __percpu *lkma_kernel_alloc_percpu(size_t size, size_t align);
+extern void *lkma_kernel_kmalloc_node(size_t size, gfp_t flags, int node);
 inline void *lkma_vmalloc(size_t size, gfp_t flags);
 
+static int lkma_cache_prepare(size_t size);
+static void lkma_cache_release(void);
+static void *lkma_cache_alloc(size_t size, gfp_t flags);
+static void *lkma_kernel_cache_alloc(size_t size, gfp_t flags);
+static void lkma_cache_free(const void *object);
+static void *lkma_pages_alloc(size_t size, gfp_t flags);
+static void *lkma_kernel_pages_alloc(size_t size, gfp_t flags);
+static void lkma_pages_free(const void *address);
+static void *lkma_percpu_alloc(size_t size, gfp_t flags);
+static void *lkma_kernel_percpu_alloc(size_t size, gfp_t flags);
+static void lkma_percpu_free(const void *address);
+static void *lkma_kmalloc_node(size_t size, gfp_t flags);
+static void *lkma_kernel_kmalloc_node_local(size_t size, gfp_t flags);
+
 /* kmalloc flags ... */
 gfp_t lkma_flags[] = {
 	GFP_KERNEL,
@@ -87,112 +130,511 @@ gfp_t lkma_flags[] = {
 	GFP_TRANSHUGE,
 };
 
+/**
+ * struct allocator - An allocation function and its free
+ * @alloc_func:    Allocation, the size may be ignored
+ * @free_func:     Free of what alloc_func returned
+ * @function_name: Name of the allocation in the results
+ * @free_name:     Name of the free in the results, timed apart
+ * @max_size:      Largest size tested
+ * @may_sleep:     Skipped by the atomic tests
+ * @prepare:       Called before testing a size, may be NULL
+ * @release:       Called after the last test, may be NULL
+ */
 struct allocator {
 	void *(*alloc_func) (size_t, gfp_t);
 	void (*free_func) (const void *);
 	const char *function_name;
+	const char *free_name;
 	unsigned long max_size;
+	bool may_sleep;
+	int (*prepare) (size_t);
+	void (*release) (void);
 };
 
+/* The module allocators, then the same ones called from the kernel */
 struct allocator allocators[] = {
 	{
 	 .alloc_func = kmalloc,
 	 .free_func = kfree,
 	 .function_name = function_name(kmalloc_module),
+	 .free_name = function_name(kfree_kmalloc_module),
 	 .max_size = KMALLOC_MAX_SIZE},
 	{
 	 .alloc_func = kzalloc,
 	 .free_func = kfree,
 	 .function_name = function_name(kzalloc_module),
+	 .free_name = function_name(kfree_kzalloc_module),
 	 .max_size = KMALLOC_MAX_SIZE},
 	{
 	 .alloc_func = lkma_vmalloc,
 	 .free_func = vfree,
 	 .function_name = function_name(vmalloc_module),
-	 .max_size = VMALLOC_MAX_SIZE},
+	 .free_name = function_name(vfree_module),
+	 .max_size = VMALLOC_MAX_SIZE,
+	 .may_sleep = true},
+	{
+	 .alloc_func = lkma_cache_alloc,
+	 .free_func = lkma_cache_free,
+	 .function_name = function_name(kmem_cache_alloc_module),
+	 .free_name = function_name(kmem_cache_free_module),
+	 .max_size = KMALLOC_MAX_SIZE,
+	 .prepare = lkma_cache_prepare,
+	 .release = lkma_cache_release},
+	{
+	 .alloc_func = lkma_pages_alloc,
+	 .free_func = lkma_pages_free,
+	 .function_name = function_name(alloc_pages_module),
+	 .free_name = function_name(free_pages_module),
+	 .max_size = PAGES_MAX_SIZE},
+	{
+	 .alloc_func = lkma_percpu_alloc,
+	 .free_func = lkma_percpu_free,
+	 .function_name = function_name(alloc_percpu_module),
+	 .free_name = function_name(free_percpu_module),
+	 .max_size = PERCPU_MAX_SIZE,
+	 .may_sleep = true},
+	{
+	 .alloc_func = lkma_kmalloc_node,
+	 .free_func = kfree,
+	 .function_name = function_name(kmalloc_node_module),
+	 .free_name = function_name(kfree_kmalloc_node_module),
+	 .max_size = KMALLOC_MAX_SIZE},
 	{
 	 .alloc_func = lkma_kernel_kmalloc,
 	 .free_func = kfree,
 	 .function_name = function_name(kmalloc_kernel),
+	 .free_name = function_name(kfree_kmalloc_kernel),
 	 .max_size = KMALLOC_MAX_SIZE},
 	{
 	 .alloc_func = lkma_kernel_kzalloc,
 	 .free_func = kfree,
 	 .function_name = function_name(kzalloc_kernel),
+	 .free_name = function_name(kfree_kzalloc_kernel),
 	 .max_size = KMALLOC_MAX_SIZE},
 	{
 	 .alloc_func = lkma_kernel_vmalloc,
 	 .free_func = vfree,
 	 .function_name = function_name(vmalloc_kernel),
-	 .max_size = VMALLOC_MAX_SIZE}
+	 .free_name = function_name(vfree_kernel),
+	 .max_size = VMALLOC_MAX_SIZE,
+	 .may_sleep = true},
+	{
+	 .alloc_func = lkma_kernel_cache_alloc,
+	 .free_func = lkma_cache_free,
+	 .function_name = function_name(kmem_cache_alloc_kernel),
+	 .free_name = function_name(kmem_cache_free_kernel),
+	 .max_size = KMALLOC_MAX_SIZE,
+	 .prepare = lkma_cache_prepare,
+	 .release = lkma_cache_release},
+	{
+	 .alloc_func = lkma_kernel_pages_alloc,
+	 .free_func = lkma_pages_free,
+	 .function_name = function_name(alloc_pages_kernel),
+	 .free_name = function_name(free_pages_kernel),
+	 .max_size = PAGES_MAX_SIZE},
+	{
+	 .alloc_func = lkma_kernel_percpu_alloc,
+	 .free_func = lkma_percpu_free,
+	 .function_name = function_name(alloc_percpu_kernel),
+	 .free_name = function_name(free_percpu_kernel),
+	 .max_size = PERCPU_MAX_SIZE,
+	 .may_sleep = true},
+	{
+	 .alloc_func = lkma_kernel_kmalloc_node_local,
+	 .free_func = kfree,
+	 .function_name = function_name(kmalloc_node_kernel),
+	 .free_name = function_name(kfree_kmalloc_node_kernel),
+	 .max_size = KMALLOC_MAX_SIZE}
 
 };
 
 #if LKMA_PROCFS
 static struct proc_dir_entry *proc_entry;
+static struct proc_dir_entry *scale_entry;
 #else
 static struct kobject *lkma_kobj;
 #endif
 
+/* debugfs directory of the binary results, NULL without debugfs */
+static struct dentry *debugfs_dir;
+
 static unsigned long step = 100;
 static unsigned long lower_limit = 1;
 static unsigned long upper_limit = 1 * MB;
 static int kernel_test;
 
+/* Allocations done before the measured ones, to warm up caches */
+static unsigned int warmup = 10;
+module_param(warmup, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(warmup, "Allocations before measuring each size");
+
+/* Measured allocations for each size */
+static unsigned int iterations = 100;
+module_param(iterations, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(iterations, "Measured allocations for each size");
+
+/*
+ * Measure with IRQs disabled, which also disables preemption. The allocations
+ * are done with GFP_ATOMIC and the allocators which may sleep are skipped.
+ */
+static bool atomic_test;
+module_param(atomic_test, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(atomic_test, "Measure with IRQs off, GFP_ATOMIC only");
+
+/* get_cycles() ticks counted over calibration_ns nanoseconds */
+static unsigned long long calibration_cycles;
+static unsigned long long calibration_ns;
+
+/**
+ * struct lkma_stats - Distribution of the cycles taken by an allocation
+ * @min:    Fastest allocation
+ * @median: 50th percentile
+ * @p90:    90th percentile
+ * @p99:    99th percentile
+ * @max:    Slowest allocation
+ */
+struct lkma_stats {
+	unsigned long long min;
+	unsigned long long median;
+	unsigned long long p90;
+	unsigned long long p99;
+	unsigned long long max;
+};
+
+/**
+ * struct lkma_run - Parameters of a run, copied when it starts
+ * @warmup:     Allocations before measuring each size
+ * @iterations: Measured allocations for each size
+ *
+ * The module parameters may change while a run is going on, its buffers are
+ * sized and its loops bounded by this copy only.
+ */
+struct lkma_run {
+	unsigned int warmup;
+	unsigned int iterations;
+};
+
 void *lkma_vmalloc(size_t size, gfp_t flags)
 {
 	return vmalloc(size);
 }
 
+/* Dedicated cache of the kmem_cache tests, made again for each size */
+static struct kmem_cache *lkma_cache;
+
+/*
+ * Serializes the runs of the proc, sysfs and debugfs files, they share
+ * lkma_cache and the state of the scalability test.
+ */
+static DEFINE_MUTEX(run_mutex);
+
+/* Copy the parameters of a run, called with run_mutex held */
+static int lkma_run_init(struct lkma_run *run)
+{
+	run->warmup = ACCESS_ONCE(warmup);
+	run->iterations = ACCESS_ONCE(iterations);
+
+	if (run->iterations == 0 || run->iterations > MAX_ITERATIONS ||
+	    run->warmup > MAX_ITERATIONS) {
+		kerr("Invalid warmup %u or iterations %u", run->warmup,
+		     run->iterations);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* A constructor keeps SLUB from merging lkma_cache with another cache */
+static void lkma_cache_ctor(void *object)
+{
+}
+
+static int lkma_cache_prepare(size_t size)
+{
+	lkma_cache_release();
+
+	lkma_cache = kmem_cache_create("lkma_performance", size, 0, 0,
+				       lkma_cache_ctor);
+	if (!lkma_cache) {
+		kerr("Failed to create a cache of %zu bytes", size);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void lkma_cache_release(void)
+{
+	if (lkma_cache) {
+		kmem_cache_destroy(lkma_cache);
+		lkma_cache = NULL;
+	}
+}
+
+static void *lkma_cache_alloc(size_t size, gfp_t flags)
+{
+	return kmem_cache_alloc(lkma_cache, flags);
+}
+
+static void *lkma_kernel_cache_alloc(size_t size, gfp_t flags)
+{
+	return lkma_kernel_kmem_cache_alloc(lkma_cache, flags);
+}
+
+static void lkma_cache_free(const void *object)
+{
+	kmem_cache_free(lkma_cache, (void *)object);
+}
+
+/* The pages are compound, their free finds the order */
+static void *lkma_pages_alloc(size_t size, gfp_t flags)
+{
+	struct page *page;
+
+	page = alloc_pages(flags | __GFP_COMP, get_order(size));
+	return page ? page_address(page) : NULL;
+}
+
+static void *lkma_kernel_pages_alloc(size_t size, gfp_t flags)
+{
+	struct page *page;
+
+	page = lkma_kernel_alloc_pages(flags | __GFP_COMP, get_order(size));
+	return page ? page_address(page) : NULL;
+}
+
+static void lkma_pages_free(const void *address)
+{
+	struct page *page = virt_to_page(address);
+
+	__free_pages(page, compound_order(page));
+}
+
+/* alloc_percpu always allocates with GFP_KERNEL */
+static void *lkma_percpu_alloc(size_t size, gfp_t flags)
+{
+	return (void __force *)__alloc_percpu(size, sizeof(long));
+}
+
+static void *lkma_kernel_percpu_alloc(size_t size, gfp_t flags)
+{
+	return (void __force *)lkma_kernel_alloc_percpu(size, sizeof(long));
+}
+
+static void lkma_percpu_free(const void *address)
+{
+	free_percpu((void __percpu __force *)address);
+}
+
+static void *lkma_kmalloc_node(size_t size, gfp_t flags)
+{
+	return kmalloc_node(size, flags, numa_node_id());
+}
+
+static void *lkma_kernel_kmalloc_node_local(size_t size, gfp_t flags)
+{
+	return lkma_kernel_kmalloc_node(size, flags, numa_node_id());
+}
+
+/*
+ * Count the get_cycles() ticks during a busy wait measured with ktime, to
+ * convert the reported cycles to nanoseconds.
+ */
+static void calibrate_cycles(void)
+{
+	unsigned long long start, end;
+	ktime_t start_time, end_time;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	start_time = ktime_get();
+	start = get_cycles();
+	mdelay(CALIBRATION_MS);
+	end = get_cycles();
+	end_time = ktime_get();
+	local_irq_restore(flags);
+
+	calibration_cycles = end - start;
+	calibration_ns = ktime_to_ns(ktime_sub(end_time, start_time));
+}
+
+/*
+ * Return the cycles taken by the allocation, the ones taken by the free are
+ * stored in free_time if it is not NULL.
+ */
 static unsigned long long generic_lkma_alloc(struct allocator *alloc,
-					     size_t alloc_size, int flag_id)
+					     size_t alloc_size, int flag_id,
+					     unsigned long long *free_time)
 {
 	void *address;
-	unsigned long long start, end;
+	unsigned long long start, end, free_start, free_end;
+	unsigned long flags = 0;
+	gfp_t gfp = lkma_flags[flag_id];
 
 	if (!alloc) {
 		kerr("NULL pointer");
 		return -1;
 	}
 
+	if (atomic_test) {
+		gfp = GFP_ATOMIC;
+		local_irq_save(flags);
+	}
+
 	start = get_cycles();
-	address = alloc->alloc_func(alloc_size, lkma_flags[flag_id]);
+	address = alloc->alloc_func(alloc_size, gfp);
 	end = get_cycles();
 
 	if (address == NULL) {
+		if (atomic_test)
+			local_irq_restore(flags);
 		kerr("Failed to allocate memory with : %pf [size = %zu]",
 		     alloc->alloc_func, alloc_size);
 		return LKMA_OOM;
 	}
 
+	free_start = get_cycles();
 	alloc->free_func(address);
+	free_end = get_cycles();
+
+	if (atomic_test)
+		local_irq_restore(flags);
+
+	if (free_time)
+		*free_time = free_end - free_start;
 
 	return end - start;
 }
 
+static int compare_cycles(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest rank percentile of sorted samples */
+static unsigned long long percentile(unsigned long long *samples,
+				     unsigned int count, unsigned int p)
+{
+	unsigned int rank = (count * p + 99) / 100;
+
+	return samples[rank ? rank - 1 : 0];
+}
+
+/* Sort count samples and fill stats with their distribution */
+static void compute_stats(unsigned long long *samples, unsigned int count,
+			  struct lkma_stats *stats)
+{
+	sort(samples, count, sizeof(*samples), compare_cycles, NULL);
+
+	stats->min = samples[0];
+	stats->median = percentile(samples, count, 50);
+	stats->p90 = percentile(samples, count, 90);
+	stats->p99 = percentile(samples, count, 99);
+	stats->max = samples[count - 1];
+}
+
+/**
+ * measure_lkma_alloc - Time an allocator on one size
+ * @alloc:      Allocator
+ * @alloc_size: Allocated size
+ * @flag_id:    Index in lkma_flags
+ * @run:        Warmup and iterations
+ * @samples:    Room for 2 * @run->iterations samples
+ * @stats:      Filled with the distribution of the allocations
+ * @free_stats: Filled with the distribution of the frees
+ *
+ * Return: 0 or LKMA_OOM if an allocation failed.
+ */
+static int measure_lkma_alloc(struct allocator *alloc, size_t alloc_size,
+			      int flag_id, const struct lkma_run *run,
+			      unsigned long long *samples,
+			      struct lkma_stats *stats,
+			      struct lkma_stats *free_stats)
+{
+	unsigned long long *free_samples = samples + run->iterations;
+	unsigned long long time, free_time;
+	unsigned int i;
+
+	for (i = 0; i < run->warmup + run->iterations; i++) {
+		time = generic_lkma_alloc(alloc, alloc_size, flag_id,
+					  &free_time);
+		if (time == (unsigned long long)LKMA_OOM)
+			return LKMA_OOM;
+
+		if (i >= run->warmup) {
+			samples[i - run->warmup] = time;
+			free_samples[i - run->warmup] = free_time;
+		}
+
+		cond_resched();
+	}
+
+	compute_stats(samples, run->iterations, stats);
+	compute_stats(free_samples, run->iterations, free_stats);
+	return 0;
+}
+
 #if LKMA_PROCFS
-static ssize_t test(struct seq_file *m,
-		    struct allocator *alloc, size_t size, size_t offset)
+static ssize_t test(struct seq_file *m, struct allocator *alloc, size_t size,
+		    size_t offset, const struct lkma_run *run,
+		    unsigned long long *samples)
 #define lkma_sprintf(buffer, offset, ...) seq_printf(buffer, ##__VA_ARGS__)
 #else
-static ssize_t test(char *m,
-		    struct allocator *alloc, size_t size, size_t offset)
+static ssize_t test(char *m, struct allocator *alloc, size_t size,
+		    size_t offset, const struct lkma_run *run,
+		    unsigned long long *samples)
 #define lkma_sprintf(buffer, offset, ...) sprintf(buffer + offset, ##__VA_ARGS__)
 #endif
 {
 
-	unsigned long long time;
+	struct lkma_stats stats, free_stats;
 	int padding = 0;
 
-	time = generic_lkma_alloc(alloc, size, DEFAULT_FLAGS_ID);
+	if (alloc->prepare && alloc->prepare(size))
+		return offset;
 
+	if (measure_lkma_alloc(alloc, size, DEFAULT_FLAGS_ID, run, samples,
+			       &stats, &free_stats))
+		return offset;
+
+	/* The median comes first, the parsers take the first number */
 	offset += lkma_sprintf(m, offset, "Test %s", alloc->function_name);
-	offset += lkma_sprintf(m, offset, " %zu%.*s.......%llu\n",
-			       size, padding, PADDING, time);
+	offset += lkma_sprintf(m, offset,
+			       " %zu%.*s.......%llu %llu %llu %llu %llu\n",
+			       size, padding, PADDING, stats.median, stats.min,
+			       stats.p90, stats.p99, stats.max);
+	offset += lkma_sprintf(m, offset, "Test %s", alloc->free_name);
+	offset += lkma_sprintf(m, offset,
+			       " %zu%.*s.......%llu %llu %llu %llu %llu\n",
+			       size, padding, PADDING, free_stats.median,
+			       free_stats.min, free_stats.p90, free_stats.p99,
+			       free_stats.max);
 	return offset;
 #undef sprintf
 }
 
+/* Comment lines, how to read the results */
+#if LKMA_PROCFS
+static ssize_t test_header(struct seq_file *m, size_t offset,
+			   const struct lkma_run *run)
+#else
+static ssize_t test_header(char *m, size_t offset, const struct lkma_run *run)
+#endif
+{
+	offset += lkma_sprintf(m, offset, "# cycles %llu ns %llu\n",
+			       calibration_cycles, calibration_ns);
+	offset += lkma_sprintf(m, offset,
+			       "# warmup %u iterations %u atomic %d\n",
+			       run->warmup, run->iterations, atomic_test);
+	offset += lkma_sprintf(m, offset,
+			       "# Test allocator size.......median min p90 p99 max\n");
+	return offset;
+}
+
 #if LKMA_PROCFS
 static int lkma_tests(struct seq_file *m, void *v)
 #else
@@ -215,16 +657,45 @@ static ssize_t lkma_tests(struct kobject *kobj, struct kobj_attribute *attr,
 	int i;
 	size_t size, limit, start;
 	ssize_t offset = 0;
-	int allocator_id = (kernel_test ? NUM_ALLOCATION / 2 : 0);
+	int allocator_id;
+	unsigned long long *samples;
+	struct lkma_run run;
+	int ret;
+
+	mutex_lock(&run_mutex);
+
+	ret = lkma_run_init(&run);
+	if (ret) {
+		mutex_unlock(&run_mutex);
+		return ret;
+	}
+
+	samples = vmalloc(2 * run.iterations * sizeof(*samples));
+	if (!samples) {
+		kerr("Unable to alloc memory with vmalloc");
+		mutex_unlock(&run_mutex);
+		return -ENOMEM;
+	}
+
+	allocator_id = (kernel_test ? NUM_ALLOCATION / 2 : 0);
 
 #if !LKMA_PROCFS
 	if (test_offset.end == false) {
 		klog("Allocator start test : %d", allocator_id);
 		allocator_id = test_offset.allocator_id;
 	}
+
+	/* A new pass, not the rest of the previous one */
+	if (test_offset.start == -1)
+		offset = test_header(m, offset, &run);
+#else
+	offset = test_header(m, offset, &run);
 #endif
 
 	for (i = allocator_id; i < allocator_id + NUM_ALLOCATION / 2; i++) {
+		if (atomic_test && allocators[i].may_sleep)
+			continue;
+
 #if LKMA_PROCFS
 		if (allocators[i].max_size < lower_limit)
 			continue;
@@ -249,23 +720,32 @@ static ssize_t lkma_tests(struct kobject *kobj, struct kobj_attribute *attr,
 
 		for (size = start; size <= limit; size += step) {
 #if !LKMA_PROCFS
-			if (offset + 60 > PAGE_SIZE) {
+			if (offset + 2 * LINE_LEN > PAGE_SIZE) {
 				test_offset.end = false;
+				test_offset.allocator_id = i;
 				test_offset.start = size;
-				test_offset.end = limit;
+				test_offset.limit = limit;
 				goto out;
 			}
 #endif
-			offset = test(m, &allocators[i], size, offset);
+			offset = test(m, &allocators[i], size, offset, &run,
+				      samples);
 		}
+
+		if (allocators[i].release)
+			allocators[i].release();
 	}
 
 #if LKMA_PROCFS
+	mutex_unlock(&run_mutex);
+	vfree(samples);
 	return 0;
 #else
  out:
+	mutex_unlock(&run_mutex);
+	vfree(samples);
 	klog("Offset = %zu", offset);
-	if (offset + 60 > PAGE_SIZE) {
+	if (offset + 2 * LINE_LEN > PAGE_SIZE) {
 		klog("Return PAGE_SIZE");
 		return offset;
 	}
@@ -283,39 +763,628 @@ static ssize_t lkma_config(struct kobject *kobj, struct kobj_attribute *attr,
 			   const char *buffer, size_t count)
 #endif
 {
+	unsigned long new_lower, new_upper, new_step;
+	unsigned int new_warmup, new_iterations;
+	int new_kernel_test;
+	ssize_t ret = count;
 	char *temp;
 #if LKMA_PROCFS
-	temp = kmalloc(count, GFP_KERNEL);
-
-	temp = kmalloc(count, GFP_KERNEL);
+	temp = kmalloc(count + 1, GFP_KERNEL);
 	if (!temp) {
 		kerr("Unable to alloc memory with kmalloc");
 		return -ENOMEM;
 	}
 
 	if (copy_from_user(temp, buffer, count)) {
-		kerr("copy_from_)user failed");
+		kerr("copy_from_user failed");
+		kfree(temp);
 		return -EFAULT;
 	}
+	temp[count] = '\0';
 #else
 	temp = (char *)buffer;
 #endif
 
-	sscanf(temp, "%lu %lu %lu %d", &lower_limit, &upper_limit, &step,
-	       &kernel_test);
+	mutex_lock(&run_mutex);
+
+	/* The warmup and the iterations are optional */
+	new_warmup = warmup;
+	new_iterations = iterations;
+	if (sscanf(temp, "%lu %lu %lu %d %u %u", &new_lower, &new_upper,
+		   &new_step, &new_kernel_test, &new_warmup,
+		   &new_iterations) < 4) {
+		ret = -EINVAL;
+		goto out;
+	}
 
 	/* Make sure that lower_limit is at least 1,
 	   otherwise vmalloc will fail */
-	if (!lower_limit)
-		lower_limit = 1;
+	if (!new_lower)
+		new_lower = 1;
+
+	if (new_lower > new_upper || !new_step ||
+	    (new_kernel_test != 0 && new_kernel_test != 1) ||
+	    new_iterations == 0 || new_iterations > MAX_ITERATIONS ||
+	    new_warmup > MAX_ITERATIONS) {
+		kerr("Invalid configuration");
+		ret = -EINVAL;
+		goto out;
+	}
 
+	lower_limit = new_lower;
+	upper_limit = new_upper;
+	step = new_step;
+	kernel_test = new_kernel_test;
+	warmup = new_warmup;
+	iterations = new_iterations;
+
+out:
+	mutex_unlock(&run_mutex);
 #if LKMA_PROCFS
 	kfree(temp);
 #endif
-	return count;
+	return ret;
 }
 
+#define LKMA_RECORD_ALLOC		0
+#define LKMA_RECORD_FREE		1
+#define LKMA_RECORD_CALIBRATION		2
+
+/**
+ * struct lkma_record - A sample of the binary results, little endian
+ * @allocator: Index in allocators[], @see the allocators debugfs file
+ * @kind:      LKMA_RECORD_ALLOC or LKMA_RECORD_FREE
+ * @flags:     gfp flags of the allocation
+ * @size:      Allocated size
+ * @iteration: Measured iteration, from 0
+ * @cpu:       CPU the sample was taken on
+ * @cycles:    get_cycles() ticks
+ *
+ * The stream starts with a LKMA_RECORD_CALIBRATION record whose @size holds
+ * the nanoseconds in which @cycles ticks were counted.
+ */
+struct lkma_record {
+	__le16 allocator;
+	__le16 kind;
+	__le32 flags;
+	__le64 size;
+	__le32 iteration;
+	__le32 cpu;
+	__le64 cycles;
+};
+
+/**
+ * struct lkma_results - State of one read of the results file
+ * @allocator_id: Allocator of the size being read
+ * @end_id:       Allocator after the last one of the sweep
+ * @size:         Size being read, 0 before the first one
+ * @limit:        Last size of the allocator
+ * @lower_limit:  First size of each allocator, as configured at open
+ * @upper_limit:  Last size of each allocator, as configured at open
+ * @step:         Size increment, as configured at open
+ * @run:          Warmup and iterations, as configured at open
+ * @records:      Records of the size being read, 2 * @run.iterations of them
+ * @count:        Records in @records
+ * @offset:       Bytes of @records already read
+ *
+ * Only the records of one size are kept, the next size is measured when
+ * they have all been read.
+ */
+struct lkma_results {
+	int allocator_id;
+	int end_id;
+	size_t size;
+	size_t limit;
+	unsigned long lower_limit;
+	unsigned long upper_limit;
+	unsigned long step;
+	struct lkma_run run;
+	struct lkma_record *records;
+	size_t count;
+	size_t offset;
+};
+
+/* Move to the next size of the sweep, false after the last one */
+static bool results_next(struct lkma_results *results)
+{
+	struct allocator *alloc;
+
+	if (results->size) {
+		results->size += results->step;
+		if (results->size <= results->limit)
+			return true;
+		results->allocator_id++;
+	}
+
+	for (; results->allocator_id < results->end_id;
+	     results->allocator_id++) {
+		alloc = &allocators[results->allocator_id];
+		if (atomic_test && alloc->may_sleep)
+			continue;
+
+		if (alloc->max_size < results->lower_limit)
+			continue;
+
+		results->limit = min(alloc->max_size, results->upper_limit);
+		results->size = results->lower_limit;
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Replace the records with every measured iteration of the current allocator
+ * on the current size, none if the allocator fails.
+ */
+static void record_lkma_alloc(struct lkma_results *results)
+{
+	struct allocator *alloc = &allocators[results->allocator_id];
+	unsigned int warmup = results->run.warmup;
+	struct lkma_record record = {
+		.allocator = cpu_to_le16(results->allocator_id),
+		.flags = cpu_to_le32(atomic_test ? GFP_ATOMIC :
+				     lkma_flags[DEFAULT_FLAGS_ID]),
+		.size = cpu_to_le64(results->size),
+	};
+	unsigned long long time, free_time;
+	unsigned int i;
+
+	results->count = 0;
+	results->offset = 0;
+
+	mutex_lock(&run_mutex);
+	if (alloc->prepare && alloc->prepare(results->size))
+		goto out;
+
+	for (i = 0; i < warmup + results->run.iterations; i++) {
+		/* Only a hint, the allocation may sleep and migrate */
+		record.cpu = cpu_to_le32(raw_smp_processor_id());
+		time = generic_lkma_alloc(alloc, results->size,
+					  DEFAULT_FLAGS_ID, &free_time);
+		if (time == (unsigned long long)LKMA_OOM) {
+			results->count = 0;
+			break;
+		}
+
+		if (i >= warmup) {
+			record.iteration = cpu_to_le32(i - warmup);
+
+			record.kind = cpu_to_le16(LKMA_RECORD_ALLOC);
+			record.cycles = cpu_to_le64(time);
+			results->records[results->count++] = record;
+
+			record.kind = cpu_to_le16(LKMA_RECORD_FREE);
+			record.cycles = cpu_to_le64(free_time);
+			results->records[results->count++] = record;
+		}
+
+		cond_resched();
+	}
+
+	/* Another run may be next, the cache is made again by prepare */
+	if (alloc->release)
+		alloc->release();
+out:
+	mutex_unlock(&run_mutex);
+}
+
+/*
+ * Start the sweep configured through the proc or sysfs entry, unlike there
+ * the results are not cut in pages. The sizes are measured as they are read.
+ */
+static int results_open(struct inode *inode, struct file *file)
+{
+	struct lkma_results *results;
+	int allocator_id, ret;
+
+	results = kzalloc(sizeof(*results), GFP_KERNEL);
+	if (!results)
+		return -ENOMEM;
+
+	mutex_lock(&run_mutex);
+	ret = lkma_run_init(&results->run);
+	allocator_id = (kernel_test ? NUM_ALLOCATION / 2 : 0);
+	results->allocator_id = allocator_id;
+	results->end_id = allocator_id + NUM_ALLOCATION / 2;
+	results->lower_limit = lower_limit;
+	results->upper_limit = upper_limit;
+	results->step = step;
+	mutex_unlock(&run_mutex);
+
+	if (ret) {
+		kfree(results);
+		return ret;
+	}
+
+	results->records = vmalloc(2 * results->run.iterations *
+				   sizeof(*results->records));
+	if (!results->records) {
+		kerr("Unable to alloc memory with vmalloc");
+		kfree(results);
+		return -ENOMEM;
+	}
+
+	/* The calibration comes first */
+	memset(results->records, 0, sizeof(*results->records));
+	results->records[0].kind = cpu_to_le16(LKMA_RECORD_CALIBRATION);
+	results->records[0].size = cpu_to_le64(calibration_ns);
+	results->records[0].cycles = cpu_to_le64(calibration_cycles);
+	results->count = 1;
+
+	file->private_data = results;
+	return nonseekable_open(inode, file);
+}
+
+static ssize_t results_read(struct file *file, char __user *buffer,
+			    size_t count, loff_t *ppos)
+{
+	struct lkma_results *results = file->private_data;
+	size_t copied = 0, bytes;
+
+	while (copied < count) {
+		/* Each size takes 2 * iterations allocations, stop when killed */
+		if (fatal_signal_pending(current))
+			return copied ? copied : -EINTR;
+
+		bytes = results->count * sizeof(*results->records) -
+			results->offset;
+		if (!bytes) {
+			if (!results_next(results))
+				break;
+
+			record_lkma_alloc(results);
+			continue;
+		}
+
+		bytes = min(bytes, count - copied);
+		if (copy_to_user(buffer + copied,
+				 (char *)results->records + results->offset,
+				 bytes))
+			return copied ? copied : -EFAULT;
+
+		results->offset += bytes;
+		copied += bytes;
+	}
+
+	*ppos += copied;
+	return copied;
+}
+
+static int results_release(struct inode *inode, struct file *file)
+{
+	struct lkma_results *results = file->private_data;
+
+	vfree(results->records);
+	kfree(results);
+	return 0;
+}
+
+static const struct file_operations results_fops = {
+	.owner = THIS_MODULE,
+	.open = results_open,
+	.read = results_read,
+	.llseek = no_llseek,
+	.release = results_release,
+};
+
+/* Index, allocation name and free name of each allocator */
+static int lkma_allocators(struct seq_file *m, void *v)
+{
+	int i;
+
+	for (i = 0; i < NUM_ALLOCATION; i++)
+		seq_printf(m, "%d %s %s\n", i, allocators[i].function_name,
+			   allocators[i].free_name);
+	return 0;
+}
+
+static int allocators_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lkma_allocators, NULL);
+}
+
+static const struct file_operations allocators_fops = {
+	.owner = THIS_MODULE,
+	.open = allocators_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 #if LKMA_PROCFS
+/* Allocator, size and CPUs of the scalability test */
+static struct allocator *scale_allocator = &allocators[0];
+static size_t scale_size = 64;
+static struct cpumask scale_cpus;
+
+/* Threads waiting for scale_go, then all started at once */
+static atomic_t scale_ready;
+static int scale_go;
+
+/**
+ * struct scale_thread - A pinned thread of the scalability test
+ * @cpu:     CPU it is bound to
+ * @run:     Warmup and iterations, the same for all the threads
+ * @samples: Room for @run->iterations samples
+ * @stats:   Distribution of the samples
+ * @start:   Time of the first measured allocation, in ns
+ * @end:     Time after the last one, in ns
+ * @ret:     0 or LKMA_OOM
+ * @done:    Completed when the thread is about to exit
+ */
+struct scale_thread {
+	int cpu;
+	const struct lkma_run *run;
+	unsigned long long *samples;
+	struct lkma_stats stats;
+	s64 start;
+	s64 end;
+	int ret;
+	struct completion done;
+};
+
+static int scale_thread_fn(void *data)
+{
+	struct scale_thread *thread = data;
+	unsigned long long time;
+	unsigned int i;
+
+	thread->ret = 0;
+	for (i = 0; i < thread->run->warmup; i++) {
+		time = generic_lkma_alloc(scale_allocator, scale_size,
+					  DEFAULT_FLAGS_ID, NULL);
+		if (time == (unsigned long long)LKMA_OOM)
+			thread->ret = LKMA_OOM;
+	}
+
+	atomic_inc(&scale_ready);
+	while (!ACCESS_ONCE(scale_go))
+		cond_resched();
+
+	thread->start = ktime_to_ns(ktime_get());
+	for (i = 0; i < thread->run->iterations && !thread->ret; i++) {
+		time = generic_lkma_alloc(scale_allocator, scale_size,
+					  DEFAULT_FLAGS_ID, NULL);
+		if (time == (unsigned long long)LKMA_OOM)
+			thread->ret = LKMA_OOM;
+		thread->samples[i] = time;
+		cond_resched();
+	}
+	thread->end = ktime_to_ns(ktime_get());
+
+	if (!thread->ret)
+		compute_stats(thread->samples, thread->run->iterations,
+			      &thread->stats);
+
+	/* The module may go as soon as the last thread completes */
+	complete_and_exit(&thread->done, 0);
+}
+
+/**
+ * scale_run - Run the alloc/free loop on the first nr_threads threads
+ * @m:          Output file
+ * @threads:    One per online CPU of scale_cpus, nr_threads of them are used
+ * @nr_threads: Number of threads
+ *
+ * Prints the operations per second of all the threads together, from the
+ * first start to the last end, then the distribution of each thread.
+ */
+static int scale_run(struct seq_file *m, struct scale_thread *threads,
+		     unsigned int nr_threads)
+{
+	struct task_struct *task;
+	s64 start, end;
+	unsigned long long ops, ns;
+	unsigned int i;
+	int ret = 0;
+
+	atomic_set(&scale_ready, 0);
+	scale_go = 0;
+
+	for (i = 0; i < nr_threads; i++) {
+		init_completion(&threads[i].done);
+		task = kthread_create_on_node(scale_thread_fn, &threads[i],
+					      cpu_to_node(threads[i].cpu),
+					      "lkma_scale/%d", threads[i].cpu);
+		if (IS_ERR(task)) {
+			kerr("Unable to create the thread of CPU %d",
+			     threads[i].cpu);
+			nr_threads = i;
+			ret = PTR_ERR(task);
+			break;
+		}
+		kthread_bind(task, threads[i].cpu);
+		wake_up_process(task);
+	}
+
+	while (atomic_read(&scale_ready) < nr_threads)
+		cond_resched();
+	smp_mb();
+	ACCESS_ONCE(scale_go) = 1;
+
+	for (i = 0; i < nr_threads; i++)
+		wait_for_completion(&threads[i].done);
+
+	if (ret)
+		return ret;
+
+	start = threads[0].start;
+	end = threads[0].end;
+	for (i = 0; i < nr_threads; i++) {
+		if (threads[i].ret)
+			return threads[i].ret;
+		start = min(start, threads[i].start);
+		end = max(end, threads[i].end);
+	}
+
+	ns = end - start;
+	ops = div64_u64((unsigned long long)nr_threads *
+			threads[0].run->iterations * NSEC_PER_SEC,
+			ns ? ns : 1);
+
+	seq_printf(m, "Threads %u.......%llu\n", nr_threads, ops);
+	for (i = 0; i < nr_threads; i++)
+		seq_printf(m, "CPU %d %u.......%llu %llu %llu %llu %llu\n",
+			   threads[i].cpu, nr_threads,
+			   threads[i].stats.median, threads[i].stats.min,
+			   threads[i].stats.p90, threads[i].stats.p99,
+			   threads[i].stats.max);
+	return 0;
+}
+
+/*
+ * Run the test with 1 thread, then 2, up to one thread per online CPU of
+ * scale_cpus and all of them allocating at the same time.
+ */
+static int lkma_scale(struct seq_file *m, void *v)
+{
+	struct scale_thread *threads;
+	struct lkma_run run;
+	cpumask_var_t cpus;
+	unsigned int nr_cpus, i = 0;
+	int cpu, ret = 0;
+
+	if (!alloc_cpumask_var(&cpus, GFP_KERNEL))
+		return -ENOMEM;
+
+	mutex_lock(&run_mutex);
+	ret = lkma_run_init(&run);
+	if (ret)
+		goto out_unlock;
+
+	/* scale_cpus is kept whole, its CPUs may come back online */
+	get_online_cpus();
+	cpumask_and(cpus, &scale_cpus, cpu_online_mask);
+	nr_cpus = cpumask_weight(cpus);
+	if (!nr_cpus) {
+		kerr("None of the CPUs of the test is online");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	threads = kcalloc(nr_cpus, sizeof(*threads), GFP_KERNEL);
+	if (!threads) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for_each_cpu(cpu, cpus) {
+		threads[i].cpu = cpu;
+		threads[i].run = &run;
+		threads[i].samples = vmalloc(run.iterations *
+					     sizeof(*threads[i].samples));
+		if (!threads[i].samples) {
+			ret = -ENOMEM;
+			goto out_free;
+		}
+		i++;
+	}
+
+	seq_printf(m, "# cycles %llu ns %llu\n", calibration_cycles,
+		   calibration_ns);
+	seq_printf(m, "# %s %zu warmup %u iterations %u atomic %d\n",
+		   scale_allocator->function_name, scale_size, run.warmup,
+		   run.iterations, atomic_test);
+	seq_printf(m, "# Threads threads.......ops/s\n");
+	seq_printf(m, "# CPU cpu threads.......median min p90 p99 max\n");
+
+	if (scale_allocator->prepare)
+		ret = scale_allocator->prepare(scale_size);
+
+	for (i = 1; i <= nr_cpus && !ret; i++)
+		ret = scale_run(m, threads, i);
+
+	if (scale_allocator->release)
+		scale_allocator->release();
+
+out_free:
+	for (i = 0; i < nr_cpus; i++)
+		vfree(threads[i].samples);
+	kfree(threads);
+out:
+	put_online_cpus();
+out_unlock:
+	mutex_unlock(&run_mutex);
+	free_cpumask_var(cpus);
+	return ret;
+}
+
+/*
+ * "<allocator> <size> [<cpu list>]", e.g. "kmalloc_module 128 0-3". All the
+ * online CPUs are used without a list.
+ */
+static ssize_t lkma_scale_config(struct file *file, const char __user *buffer,
+				 size_t count, loff_t *data)
+{
+	char *temp, name[32];
+	size_t size;
+	int i, cpus = 0;
+
+	temp = kmalloc(count + 1, GFP_KERNEL);
+	if (!temp) {
+		kerr("Unable to alloc memory with kmalloc");
+		return -ENOMEM;
+	}
+
+	if (copy_from_user(temp, buffer, count)) {
+		kerr("copy_from_user failed");
+		kfree(temp);
+		return -EFAULT;
+	}
+	temp[count] = '\0';
+
+	if (sscanf(temp, "%31s %zu %n", name, &size, &cpus) < 2 || !size) {
+		kfree(temp);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < NUM_ALLOCATION; i++)
+		if (strcmp(allocators[i].function_name, name) == 0)
+			break;
+
+	if (i == NUM_ALLOCATION || size > allocators[i].max_size ||
+	    (atomic_test && allocators[i].may_sleep)) {
+		kerr("Invalid allocator %s for size %zu", name, size);
+		kfree(temp);
+		return -EINVAL;
+	}
+
+	mutex_lock(&run_mutex);
+	if (cpus && temp[cpus] != '\0' && temp[cpus] != '\n') {
+		if (cpulist_parse(strim(temp + cpus), &scale_cpus) ||
+		    cpumask_empty(&scale_cpus)) {
+			cpumask_copy(&scale_cpus, cpu_online_mask);
+			mutex_unlock(&run_mutex);
+			kfree(temp);
+			return -EINVAL;
+		}
+	} else {
+		cpumask_copy(&scale_cpus, cpu_online_mask);
+	}
+
+	scale_allocator = &allocators[i];
+	scale_size = size;
+	mutex_unlock(&run_mutex);
+
+	kfree(temp);
+	return count;
+}
+
+static int lkma_scale_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lkma_scale, NULL);
+}
+
+static const struct file_operations lkma_scale_fops = {
+	.owner = THIS_MODULE,
+	.open = lkma_scale_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+	.write = lkma_scale_config,
+};
+
 static int lkma_open(struct inode *inode, struct file *file)
 {
 	return single_open(file, lkma_tests, NULL);
@@ -352,6 +1421,15 @@ static int lkma_test_init(void)
 		kerr("Couldn't create proc entry");
 		return -ENOMEM;
 	}
+
+	cpumask_copy(&scale_cpus, cpu_online_mask);
+	scale_entry = proc_create(SCALE_FILENAME, 0, NULL, &lkma_scale_fops);
+
+	if (scale_entry == NULL) {
+		kerr("Couldn't create proc entry");
+		remove_proc_entry(PROC_FILENAME, NULL);
+		return -ENOMEM;
+	}
 #else
 	int ret;
 
@@ -364,6 +1442,21 @@ static int lkma_test_init(void)
 		kobject_put(lkma_kobj);
 #endif
 
+	calibrate_cycles();
+
+	/* The text results still work without debugfs */
+	debugfs_dir = debugfs_create_dir(THIS_MODULE->name, NULL);
+	if (IS_ERR_OR_NULL(debugfs_dir) ||
+	    !debugfs_create_file(RESULTS_FILENAME, S_IRUSR, debugfs_dir, NULL,
+				 &results_fops) ||
+	    !debugfs_create_file(ALLOCATORS_FILENAME, S_IRUGO, debugfs_dir,
+				 NULL, &allocators_fops)) {
+		kerr("Couldn't create the debugfs entries");
+		if (!IS_ERR(debugfs_dir))
+			debugfs_remove_recursive(debugfs_dir);
+		debugfs_dir = NULL;
+	}
+
 	pr_debug("[%s] Module %s loaded\n", THIS_MODULE->name,
 	       THIS_MODULE->name);
 	return 0;
@@ -371,7 +1464,10 @@ static int lkma_test_init(void)
 
 static void lkma_test_exit(void)
 {
+	debugfs_remove_recursive(debugfs_dir);
+
 #if LKMA_PROCFS
+	remove_proc_entry(SCALE_FILENAME, NULL);
 	remove_proc_entry(PROC_FILENAME, NULL);
 #else
 	kobject_put(lkma_kobj);
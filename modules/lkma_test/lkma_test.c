@@ -4,6 +4,16 @@
 #include <linux/slab.h>
 #include <linux/list.h>
 #include <linux/net.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/llist.h>
+#include <linux/random.h>
+#include <linux/jiffies.h>
+#include <linux/cpumask.h>
+#include <linux/cpu.h>
+#include <linux/kallsyms.h>
+#include <linux/string.h>
 
 MODULE_DESCRIPTION("LKMA Test suite");
 MODULE_AUTHOR("Ghennadi Procopciuc");
@@ -21,6 +31,12 @@ MODULE_LICENSE("GPL");
 #define KB 1024
 #define MB 1024 * KB
 
+/* Largest object of the stress test, header included */
+#define STRESS_MAX_SIZE		(2 * PAGE_SIZE)
+
+/* Source of the allocators of the LKMA kernel test module */
+#define KERNEL_TEST_FILE	"drivers/block/lkma_kernel_test.c"
+
 #define NUM_ALLOCATION	  	array_size(lkma_alloc_func)
 
 #define DEBUG
@@ -43,7 +59,8 @@ MODULE_LICENSE("GPL");
 #define array_size(array)		(sizeof(array) / sizeof(*array))
 #define check_array_size(array, size)	(array_size(array) == size)
 
-#define zero_memory_allocated()		(THIS_MODULE->allocated_size == 0)
+#define zero_memory_allocated()		\
+	(atomic_long_read(&THIS_MODULE->allocated_size) == 0)
 
 #define check_test(ret, test_name)						\
 	({									\
@@ -82,6 +99,27 @@ struct {
 	[0 ... MAX_ALLOCATIONS - 1] = {.empty = true}
 };
 
+/* Stack of the empty positions of `allocations', filled at init */
+static int empty_positions[MAX_ALLOCATIONS];
+static int empty_count;
+
+/*
+ * Number of threads of the stress test, 0 skips it. Each thread gets its own
+ * online CPU, so more threads than CPUs are cut and at least 2 are needed.
+ */
+static unsigned int stress_threads;
+module_param(stress_threads, uint, S_IRUGO);
+MODULE_PARM_DESC(stress_threads, "Threads of the stress test, 0 = off");
+
+static unsigned int stress_seconds = 5;
+module_param(stress_seconds, uint, S_IRUGO);
+MODULE_PARM_DESC(stress_seconds, "Duration of the stress test");
+
+/* Objects allocated and not yet freed, per thread */
+static unsigned int stress_objects = 1024;
+module_param(stress_objects, uint, S_IRUGO);
+MODULE_PARM_DESC(stress_objects, "Objects in flight per stress thread");
+
 /* kmalloc flags ... */
 gfp_t lkma_flags[] = {
 	GFP_KERNEL,
@@ -120,16 +158,22 @@ void *lkma_vmalloc(size_t size, gfp_t flags)
 	return vmalloc(size);
 }
 
-static int get_empty_position(void)
+static void init_empty_positions(void)
 {
 	int i;
 
-	for (i = 0; i < MAX_ALLOCATIONS; i++) {
-		if (allocations[i].empty)
-			return i;
-	}
+	/* The lowest positions are given first */
+	for (i = 0; i < MAX_ALLOCATIONS; i++)
+		empty_positions[i] = MAX_ALLOCATIONS - 1 - i;
+	empty_count = MAX_ALLOCATIONS;
+}
 
-	return -1;
+static int get_empty_position(void)
+{
+	if (empty_count == 0)
+		return -1;
+
+	return empty_positions[--empty_count];
 }
 
 static int add_address(void *address, void (*free_funct) (const void *))
@@ -149,7 +193,7 @@ static int add_address(void *address, void (*free_funct) (const void *))
 
 static int del_address(int index)
 {
-	if (index < 0 || index > MAX_ALLOCATIONS) {
+	if (index < 0 || index >= MAX_ALLOCATIONS) {
 		kerr("Wrong index %d\n", index);
 		return -1;
 	}
@@ -161,6 +205,7 @@ static int del_address(int index)
 
 	allocations[index].free_funct(allocations[index].address);
 	allocations[index].empty = true;
+	empty_positions[empty_count++] = index;
 	return 0;
 }
 
@@ -334,6 +379,323 @@ static int mixed_allocations(void)
 	return 0;
 }
 
+#if IS_ENABLED(CONFIG_LKMA_KERNEL_TEST)
+extern void *lkma_kernel_kmalloc(size_t size, gfp_t flags);
+extern void *lkma_kernel_kzalloc(size_t size, gfp_t flags);
+extern void *lkma_kernel_vmalloc(size_t size, gfp_t flags);
+#endif
+
+extern const struct kallsyms_trie_node kallsyms_trie[];
+extern const char kallsyms_trie_names[];
+extern atomic_long_t kallsyms_trie_sizes[];
+
+/**
+ * struct stress_family - An allocator of the stress test
+ * @alloc_funct: Allocation
+ * @free_funct:  Release, called from another CPU
+ * @kernel:      Charged to KERNEL_TEST_FILE instead of this module
+ */
+struct stress_family {
+	void *(*alloc_funct) (size_t, gfp_t);
+	void (*free_funct) (const void *);
+	bool kernel;
+};
+
+static struct stress_family stress_families[] = {
+	{kmalloc, kfree, false},
+	{kzalloc, kfree, false},
+	{lkma_vmalloc, vfree, false},
+#if IS_ENABLED(CONFIG_LKMA_KERNEL_TEST)
+	{lkma_kernel_kmalloc, kfree, true},
+	{lkma_kernel_kzalloc, kfree, true},
+	{lkma_kernel_vmalloc, vfree, true},
+#endif
+};
+
+struct stress_thread;
+
+/**
+ * struct stress_object - Header of an object of the stress test
+ * @node:   Link in the inbox of the thread which frees it
+ * @owner:  Thread which allocated it
+ * @family: Index in stress_families
+ */
+struct stress_object {
+	struct llist_node node;
+	struct stress_thread *owner;
+	int family;
+};
+
+/**
+ * struct stress_thread - A pinned thread of the stress test
+ * @cpu:      CPU it is bound to
+ * @inbox:    Objects allocated by the other threads, to free
+ * @live:     Objects allocated by this thread and not yet freed
+ * @allocs:   Successful allocations
+ * @frees:    Objects freed
+ * @failures: Failed allocations, expected with the atomic flags
+ * @done:     Completed when the thread is about to exit
+ */
+struct stress_thread {
+	int cpu;
+	struct llist_head inbox;
+	atomic_t live;
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long failures;
+	struct completion done;
+};
+
+static struct stress_thread *stress;
+static unsigned int stress_nr_threads;
+
+/* Threads waiting for stress_go, then threads done allocating */
+static atomic_t stress_ready;
+static atomic_t stress_stopped;
+static int stress_go;
+
+/* The slab allocators refuse highmem, vmalloc ignores the flags */
+static bool stress_flags_valid(gfp_t flags)
+{
+	return !(flags & (__GFP_HIGHMEM | __GFP_MOVABLE));
+}
+
+static void stress_drain(struct stress_thread *thread)
+{
+	struct stress_object *object, *next;
+	struct llist_node *first;
+
+	first = llist_del_all(&thread->inbox);
+	if (!first)
+		return;
+
+	llist_for_each_entry_safe(object, next, first, node) {
+		atomic_dec(&object->owner->live);
+		stress_families[object->family].free_funct(object);
+		thread->frees++;
+	}
+}
+
+static void stress_alloc(struct stress_thread *thread)
+{
+	struct stress_object *object;
+	struct stress_thread *target;
+	int family, flag_id;
+	size_t size;
+
+	family = prandom_u32() % array_size(stress_families);
+	do {
+		flag_id = prandom_u32() % array_size(lkma_flags);
+	} while (!stress_flags_valid(lkma_flags[flag_id]));
+	size = sizeof(*object) +
+	    prandom_u32() % (STRESS_MAX_SIZE - sizeof(*object));
+
+	object = stress_families[family].alloc_funct(size, lkma_flags[flag_id]);
+	if (!object) {
+		thread->failures++;
+		return;
+	}
+
+	object->owner = thread;
+	object->family = family;
+	atomic_inc(&thread->live);
+	thread->allocs++;
+
+	/* Freed by another thread, so from another CPU */
+	target = &stress[(thread - stress + 1 +
+			  prandom_u32() % (stress_nr_threads - 1)) %
+			 stress_nr_threads];
+	llist_add(&object->node, &target->inbox);
+}
+
+static int stress_thread_fn(void *data)
+{
+	struct stress_thread *thread = data;
+	unsigned long deadline;
+
+	atomic_inc(&stress_ready);
+	while (!ACCESS_ONCE(stress_go))
+		cond_resched();
+
+	deadline = jiffies + stress_seconds * HZ;
+	while (time_before(jiffies, deadline)) {
+		stress_drain(thread);
+		if (atomic_read(&thread->live) < stress_objects)
+			stress_alloc(thread);
+		cond_resched();
+	}
+
+	/* The others may still send objects until they stop too */
+	atomic_inc_return(&stress_stopped);
+	while (atomic_read(&stress_stopped) < stress_nr_threads) {
+		stress_drain(thread);
+		cond_resched();
+	}
+	stress_drain(thread);
+
+	complete(&thread->done);
+	return 0;
+}
+
+/**
+ * find_trie_node - Get the node of a path from kallsyms_trie
+ * @path: Path relative to the root of the sources
+ *
+ * Return: Node id or 0 if the path is not in the trie
+ */
+static unsigned long find_trie_node(const char *path)
+{
+	unsigned long node = 0, child, end;
+	char *copy, *cursor, *token;
+
+	copy = kstrdup(path, GFP_KERNEL);
+	if (!copy)
+		return 0;
+
+	cursor = copy;
+	while (node != -1UL && (token = strsep(&cursor, "/"))) {
+		child = kallsyms_trie[node].children;
+		end = child + kallsyms_trie[node].children_num;
+		for (node = -1UL; child < end; child++) {
+			if (!strcmp(kallsyms_trie_names +
+				    kallsyms_trie[child].name, token)) {
+				node = child;
+				break;
+			}
+		}
+	}
+
+	kfree(copy);
+	return node == -1UL ? 0 : node;
+}
+
+/**
+ * stress_test - Allocate on a CPU and free on another, from several threads
+ *
+ * Each pinned thread allocates objects with a random allocator, flag and
+ * size, then sends them through a lock-free list to a thread bound to
+ * another CPU, which frees them. After stress_seconds all the objects are
+ * freed, so the counters of this module and of the trie node of
+ * KERNEL_TEST_FILE have to be back to their values from before the test.
+ */
+static int stress_test(void)
+{
+	struct task_struct *task;
+	unsigned long allocs = 0, frees = 0, failures = 0;
+	unsigned long kernel_node = 0;
+	long module_before, module_after;
+	long kernel_before = 0, kernel_after = 0;
+	unsigned int i;
+	int cpu, ret = 0;
+	s64 start, ns;
+
+	if (IS_ENABLED(CONFIG_LKMA_KERNEL_TEST)) {
+		kernel_node = find_trie_node(KERNEL_TEST_FILE);
+		if (!kernel_node) {
+			kerr("No trie node for %s", KERNEL_TEST_FILE);
+			return -1;
+		}
+		kernel_before =
+		    atomic_long_read(&kallsyms_trie_sizes[kernel_node]);
+	}
+	get_online_cpus();
+	stress_nr_threads = min(stress_threads, num_online_cpus());
+	if (stress_nr_threads < 2) {
+		kerr("Need 2 threads on distinct CPUs, %u threads %u CPUs",
+		     stress_threads, num_online_cpus());
+		put_online_cpus();
+		return -EINVAL;
+	}
+
+	stress = kcalloc(stress_nr_threads, sizeof(*stress), GFP_KERNEL);
+	if (!stress) {
+		put_online_cpus();
+		return -ENOMEM;
+	}
+
+	/* After the kcalloc, which is charged to this module until the kfree */
+	module_before = atomic_long_read(&THIS_MODULE->allocated_size);
+
+	atomic_set(&stress_ready, 0);
+	atomic_set(&stress_stopped, 0);
+	stress_go = 0;
+
+	cpu = cpumask_first(cpu_online_mask);
+	for (i = 0; i < stress_nr_threads; i++) {
+		stress[i].cpu = cpu;
+		init_llist_head(&stress[i].inbox);
+		atomic_set(&stress[i].live, 0);
+		init_completion(&stress[i].done);
+
+		cpu = cpumask_next(cpu, cpu_online_mask);
+	}
+
+	for (i = 0; i < stress_nr_threads; i++) {
+		task = kthread_create_on_node(stress_thread_fn, &stress[i],
+					      cpu_to_node(stress[i].cpu),
+					      "lkma_stress/%u", i);
+		if (IS_ERR(task)) {
+			kerr("Unable to create stress thread %u", i);
+			ret = PTR_ERR(task);
+			/* The threads already started stop at once */
+			stress_seconds = 0;
+			stress_nr_threads = i;
+			break;
+		}
+		kthread_bind(task, stress[i].cpu);
+		wake_up_process(task);
+	}
+
+	while (atomic_read(&stress_ready) < stress_nr_threads)
+		cond_resched();
+	smp_mb();
+	start = ktime_to_ns(ktime_get());
+	ACCESS_ONCE(stress_go) = 1;
+
+	for (i = 0; i < stress_nr_threads; i++)
+		wait_for_completion(&stress[i].done);
+	ns = ktime_to_ns(ktime_get()) - start;
+
+	for (i = 0; i < stress_nr_threads; i++) {
+		klog("CPU %d.......%lu allocs %lu frees %lu failures",
+		     stress[i].cpu, stress[i].allocs, stress[i].frees,
+		     stress[i].failures);
+		allocs += stress[i].allocs;
+		frees += stress[i].frees;
+		failures += stress[i].failures;
+	}
+	klog("Threads %u.......%llu ops/s", stress_nr_threads,
+	     div64_u64((u64)(allocs + frees) * NSEC_PER_SEC, ns ? ns : 1));
+
+	if (allocs != frees) {
+		kerr("%lu objects allocated, %lu freed", allocs, frees);
+		ret = -1;
+	}
+
+	module_after = atomic_long_read(&THIS_MODULE->allocated_size);
+	if (module_after != module_before) {
+		kerr("Module counter drifted by %ld bytes",
+		     module_after - module_before);
+		ret = -1;
+	}
+
+	if (kernel_node) {
+		kernel_after =
+		    atomic_long_read(&kallsyms_trie_sizes[kernel_node]);
+		if (kernel_after != kernel_before) {
+			kerr("%s counter drifted by %ld bytes",
+			     KERNEL_TEST_FILE, kernel_after - kernel_before);
+			ret = -1;
+		}
+	}
+
+	kfree(stress);
+	stress = NULL;
+	put_online_cpus();
+
+	return ret;
+}
+
 BUILD_TEST(kmalloc, simple);
 BUILD_TEST(kzalloc, simple);
 BUILD_TEST(lkma_vmalloc, simple);
@@ -371,6 +733,8 @@ static int lkma_test_init(void)
 	printk(KERN_DEBUG "[%s] Module %s loaded\n", THIS_MODULE->name,
 	       THIS_MODULE->name);
 
+	init_empty_positions();
+
 	start_test(sanity_checks);
 
 	start_test(kmalloc_simple);
@@ -387,6 +751,9 @@ static int lkma_test_init(void)
 
 	start_test(mixed_allocations);
 
+	if (stress_threads)
+		start_test(stress_test);
+
 	return 0;
 }
 
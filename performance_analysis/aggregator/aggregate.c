@@ -0,0 +1,623 @@
+/**
+ * Aggregate the results of lkma_performance in a single pass.
+ *
+ * Reads the binary records of the debugfs results file (*.bin) or the text
+ * samples of the proc entry (*.data) and writes one CSV line per test and
+ * size, with the distribution of the samples and, for the kernel variants,
+ * the ratio of their median to the one of the module variants. The size where
+ * the median of a test changes by more than a factor, as when kmalloc falls
+ * back to the page allocator, is written to a second CSV.
+ *
+ * Usage : aggregate [-o output] [-s steps] [-a allocators] [-w window]
+ *                   [-t factor] <file or directory>...
+ */
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define NAME_LEN		64
+#define MAX_NAMES		256
+#define LINE_LEN		512
+#define MIN_BUCKETS		(1 << 12)
+#define DEFAULT_WINDOW		8
+#define DEFAULT_FACTOR		1.5
+#define ALLOCATORS_FILENAME	"allocators"
+#define KERNEL_SUFFIX		"_kernel"
+#define MODULE_SUFFIX		"_module"
+
+/* Kinds of the binary records, as in lkma_performance.c */
+#define RECORD_ALLOC		0
+#define RECORD_FREE		1
+#define RECORD_CALIBRATION	2
+
+/* Binary record of lkma_performance, little endian */
+struct record {
+	uint16_t allocator;
+	uint16_t kind;
+	uint32_t flags;
+	uint64_t size;
+	uint32_t iteration;
+	uint32_t cpu;
+	uint64_t cycles;
+};
+
+/* Samples of one test on one size */
+struct group {
+	unsigned int name;
+	uint64_t size;
+	uint64_t *samples;
+	size_t count;
+	size_t capacity;
+	uint64_t median;
+};
+
+/* Names of the allocations and frees of an allocators file, by index */
+struct allocators {
+	char dir[PATH_MAX];
+	unsigned int alloc[MAX_NAMES];
+	unsigned int free[MAX_NAMES];
+	unsigned int count;
+};
+
+static char names[MAX_NAMES][NAME_LEN];
+static unsigned int names_count;
+
+/* Open addressing table of the groups, indexed by name and size */
+static struct group *groups;
+static size_t buckets;
+static size_t groups_count;
+
+static struct allocators allocators;
+static const char *allocators_path;
+
+static unsigned long long records_count;
+static unsigned long long calibration_cycles;
+static unsigned long long calibration_ns;
+
+static void print_usage(char **argv)
+{
+	fprintf(stderr, "Usage : %s [-o output] [-s steps] [-a allocators] "
+		"[-w window] [-t factor] <file or directory>...\n", argv[0]);
+	exit(EXIT_FAILURE);
+}
+
+static void *xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (!ptr) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return ptr;
+}
+
+static unsigned int get_name(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < names_count; i++)
+		if (!strcmp(names[i], name))
+			return i;
+
+	if (names_count == MAX_NAMES) {
+		fprintf(stderr, "Too many tests, ignoring : %s\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	snprintf(names[names_count], NAME_LEN, "%s", name);
+	return names_count++;
+}
+
+static size_t hash(unsigned int name, uint64_t size)
+{
+	uint64_t key = size * 0x9e3779b97f4a7c15ULL + name;
+
+	return (key ^ (key >> 29)) & (buckets - 1);
+}
+
+static void grow_groups(void)
+{
+	struct group *old = groups;
+	size_t old_buckets = buckets;
+	size_t i, j;
+
+	buckets = buckets ? buckets * 2 : MIN_BUCKETS;
+	groups = calloc(buckets, sizeof(*groups));
+	if (!groups) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < old_buckets; i++) {
+		if (!old[i].samples)
+			continue;
+
+		for (j = hash(old[i].name, old[i].size); groups[j].samples;
+		     j = (j + 1) & (buckets - 1))
+			;
+		groups[j] = old[i];
+	}
+
+	free(old);
+}
+
+static struct group *get_group(unsigned int name, uint64_t size)
+{
+	size_t i;
+
+	if ((groups_count + 1) * 10 > buckets * 7)
+		grow_groups();
+
+	for (i = hash(name, size); groups[i].samples;
+	     i = (i + 1) & (buckets - 1))
+		if (groups[i].name == name && groups[i].size == size)
+			return &groups[i];
+
+	groups[i].name = name;
+	groups[i].size = size;
+	groups[i].capacity = 16;
+	groups[i].samples = xrealloc(NULL, 16 * sizeof(uint64_t));
+	groups_count++;
+
+	return &groups[i];
+}
+
+static void add_sample(unsigned int name, uint64_t size, uint64_t cycles)
+{
+	struct group *group = get_group(name, size);
+
+	if (group->count == group->capacity) {
+		group->capacity *= 2;
+		group->samples = xrealloc(group->samples,
+					  group->capacity * sizeof(uint64_t));
+	}
+
+	group->samples[group->count++] = cycles;
+	records_count++;
+}
+
+/* Load the names of the allocators file lying next to a binary file */
+static void load_allocators(const char *path)
+{
+	char dir[PATH_MAX], file[PATH_MAX + sizeof(ALLOCATORS_FILENAME)];
+	char line[LINE_LEN], alloc[NAME_LEN], free_name[NAME_LEN];
+	char *slash;
+	unsigned int index;
+	FILE *stream;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	slash = strrchr(dir, '/');
+	if (slash)
+		*slash = '\0';
+	else
+		strcpy(dir, ".");
+
+	if (allocators.count && !strcmp(allocators.dir, dir))
+		return;
+
+	if (allocators_path)
+		snprintf(file, sizeof(file), "%s", allocators_path);
+	else
+		snprintf(file, sizeof(file), "%s/%s", dir,
+			 ALLOCATORS_FILENAME);
+
+	stream = fopen(file, "r");
+	if (!stream) {
+		fprintf(stderr, "Unable to open %s : %s\n", file,
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&allocators, 0, sizeof(allocators));
+	snprintf(allocators.dir, sizeof(allocators.dir), "%s", dir);
+
+	while (fgets(line, sizeof(line), stream)) {
+		if (sscanf(line, "%u %63s %63s", &index, alloc, free_name) != 3
+		    || index >= MAX_NAMES)
+			continue;
+
+		allocators.alloc[index] = get_name(alloc);
+		allocators.free[index] = get_name(free_name);
+		if (index >= allocators.count)
+			allocators.count = index + 1;
+	}
+
+	fclose(stream);
+}
+
+static void read_binary(const char *path)
+{
+	struct record record;
+	FILE *stream;
+
+	load_allocators(path);
+
+	stream = fopen(path, "rb");
+	if (!stream) {
+		fprintf(stderr, "Unable to open %s : %s\n", path,
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	while (fread(&record, sizeof(record), 1, stream) == 1) {
+		record.allocator = le16toh(record.allocator);
+		record.kind = le16toh(record.kind);
+		record.size = le64toh(record.size);
+		record.cycles = le64toh(record.cycles);
+
+		if (record.kind == RECORD_CALIBRATION) {
+			calibration_cycles += record.cycles;
+			calibration_ns += record.size;
+			continue;
+		}
+
+		if (record.allocator >= allocators.count) {
+			fprintf(stderr, "%s : unknown allocator %u\n", path,
+				record.allocator);
+			continue;
+		}
+
+		add_sample(record.kind == RECORD_FREE ?
+			   allocators.free[record.allocator] :
+			   allocators.alloc[record.allocator],
+			   record.size, record.cycles);
+	}
+
+	fclose(stream);
+}
+
+/*
+ * The lines are "Test <name> <size>.......<cycles>", with the distribution
+ * of the samples after the first number for the older results.
+ */
+static void read_text(const char *path)
+{
+	char line[LINE_LEN], name[NAME_LEN];
+	unsigned long long size, cycles;
+	FILE *stream;
+
+	stream = fopen(path, "r");
+	if (!stream) {
+		fprintf(stderr, "Unable to open %s : %s\n", path,
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	while (fgets(line, sizeof(line), stream)) {
+		if (sscanf(line, "Test %63s %llu%*[.]%llu", name, &size,
+			   &cycles) != 3)
+			continue;
+
+		add_sample(get_name(name), size, cycles);
+	}
+
+	fclose(stream);
+}
+
+static int has_suffix(const char *name, const char *suffix)
+{
+	size_t len = strlen(name), suffix_len = strlen(suffix);
+
+	return len >= suffix_len && !strcmp(name + len - suffix_len, suffix);
+}
+
+static void read_path(const char *path);
+
+/* Read the binary results of a directory, or its text ones if none */
+static void read_directory(const char *path)
+{
+	char file[PATH_MAX];
+	const char *suffixes[] = {".bin", ".data"};
+	struct dirent *entry;
+	unsigned int i, found = 0;
+	DIR *dir;
+
+	for (i = 0; i < 2 && !found; i++) {
+		dir = opendir(path);
+		if (!dir) {
+			fprintf(stderr, "Unable to open %s : %s\n", path,
+				strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		while ((entry = readdir(dir))) {
+			if (!has_suffix(entry->d_name, suffixes[i]))
+				continue;
+
+			snprintf(file, sizeof(file), "%s/%s", path,
+				 entry->d_name);
+			read_path(file);
+			found++;
+		}
+
+		closedir(dir);
+	}
+}
+
+static void read_path(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st)) {
+		fprintf(stderr, "Unable to stat %s : %s\n", path,
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if (S_ISDIR(st.st_mode))
+		read_directory(path);
+	else if (has_suffix(path, ".bin"))
+		read_binary(path);
+	else
+		read_text(path);
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int compare_groups(const void *a, const void *b)
+{
+	const struct group *x = a, *y = b;
+	int ret = strcmp(names[x->name], names[y->name]);
+
+	if (ret)
+		return ret;
+
+	return (x->size > y->size) - (x->size < y->size);
+}
+
+/* Nearest rank, as computed by lkma_performance */
+static uint64_t percentile(const struct group *group, unsigned int p)
+{
+	size_t rank = (group->count * p + 99) / 100;
+
+	return group->samples[rank ? rank - 1 : 0];
+}
+
+/* Pack the groups at the start of the table, sorted by name and size */
+static void sort_groups(void)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < buckets; i++)
+		if (groups[i].samples)
+			groups[count++] = groups[i];
+
+	qsort(groups, count, sizeof(*groups), compare_groups);
+
+	for (i = 0; i < count; i++) {
+		qsort(groups[i].samples, groups[i].count, sizeof(uint64_t),
+		      compare_samples);
+		groups[i].median = percentile(&groups[i], 50);
+	}
+}
+
+/* Group of the module variant of a kernel test, on the same size */
+static struct group *get_module_group(const struct group *group)
+{
+	char name[NAME_LEN];
+	struct group key, *found;
+	unsigned int i;
+
+	if (!has_suffix(names[group->name], KERNEL_SUFFIX))
+		return NULL;
+
+	snprintf(name, sizeof(name), "%.*s" MODULE_SUFFIX,
+		 (int)(strlen(names[group->name]) - strlen(KERNEL_SUFFIX)),
+		 names[group->name]);
+
+	for (i = 0; i < names_count; i++)
+		if (!strcmp(names[i], name))
+			break;
+	if (i == names_count)
+		return NULL;
+
+	key.name = i;
+	key.size = group->size;
+	found = bsearch(&key, groups, groups_count, sizeof(*groups),
+			compare_groups);
+
+	return found && found->median ? found : NULL;
+}
+
+static void write_groups(FILE *stream)
+{
+	struct group *group, *module;
+	long double sum;
+	size_t i, j;
+
+	fprintf(stream, "test,size,count,min,p50,p90,p99,max,mean,ratio\n");
+
+	for (i = 0; i < groups_count; i++) {
+		group = &groups[i];
+
+		for (sum = 0, j = 0; j < group->count; j++)
+			sum += group->samples[j];
+
+		fprintf(stream, "%s,%llu,%zu,%llu,%llu,%llu,%llu,%llu,%.1Lf,",
+			names[group->name], (unsigned long long)group->size,
+			group->count,
+			(unsigned long long)group->samples[0],
+			(unsigned long long)group->median,
+			(unsigned long long)percentile(group, 90),
+			(unsigned long long)percentile(group, 99),
+			(unsigned long long)group->samples[group->count - 1],
+			sum / group->count);
+
+		module = get_module_group(group);
+		if (module)
+			fprintf(stream, "%.3f", (double)group->median /
+				module->median);
+		fprintf(stream, "\n");
+	}
+}
+
+static uint64_t median_of(uint64_t *values, size_t count)
+{
+	qsort(values, count, sizeof(*values), compare_samples);
+	return values[count / 2];
+}
+
+/* Median of the medians of window consecutive sizes */
+static double window_median(const struct group *first, size_t window)
+{
+	uint64_t values[window];
+	size_t i;
+
+	for (i = 0; i < window; i++)
+		values[i] = first[i].median;
+
+	return median_of(values, window);
+}
+
+static double step_ratio(const struct group *at, size_t window)
+{
+	double before = window_median(at - window, window);
+	double after = window_median(at, window);
+
+	return before ? after / before : 0;
+}
+
+/*
+ * A step is where the median of the next window sizes differs from the one
+ * of the previous window sizes by more than factor. It is reported at the
+ * first size whose median is closer to the level after the step than to the
+ * one before.
+ */
+static void write_steps(FILE *stream, size_t window, double factor)
+{
+	struct group *series;
+	size_t start, end, i, j, best;
+	double ratio, best_ratio, before, after;
+
+	fprintf(stream, "test,size,before,after,ratio\n");
+
+	for (start = 0; start < groups_count; start = end) {
+		for (end = start; end < groups_count &&
+		     groups[end].name == groups[start].name; end++)
+			;
+		series = &groups[start];
+
+		for (i = window; i + window <= end - start; i++) {
+			ratio = step_ratio(&series[i], window);
+			if (!ratio || fabs(log(ratio)) < log(factor))
+				continue;
+
+			best = i;
+			best_ratio = ratio;
+			for (j = i + 1; j < i + window &&
+			     j + window <= end - start; j++) {
+				ratio = step_ratio(&series[j], window);
+				if (ratio && fabs(log(ratio)) >
+				    fabs(log(best_ratio))) {
+					best = j;
+					best_ratio = ratio;
+				}
+			}
+
+			before = window_median(&series[best - window], window);
+			after = window_median(&series[best], window);
+			for (j = best - window; j < best + window - 1; j++)
+				if (series[j].median && fabs(log(after /
+				    series[j].median)) < fabs(log(before /
+				    series[j].median)))
+					break;
+
+			fprintf(stream, "%s,%llu,%.0f,%.0f,%.3f\n",
+				names[series[j].name],
+				(unsigned long long)series[j].size,
+				before, after, best_ratio);
+			i = j + window - 1;
+		}
+	}
+}
+
+static FILE *open_output(const char *path)
+{
+	FILE *stream;
+
+	if (!path)
+		return stdout;
+
+	stream = fopen(path, "w");
+	if (!stream) {
+		fprintf(stderr, "Unable to open %s : %s\n", path,
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	return stream;
+}
+
+int main(int argc, char **argv)
+{
+	const char *output = NULL, *steps = NULL;
+	size_t window = DEFAULT_WINDOW;
+	double factor = DEFAULT_FACTOR;
+	FILE *stream;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:s:a:w:t:")) != -1) {
+		switch (opt) {
+		case 'o':
+			output = optarg;
+			break;
+		case 's':
+			steps = optarg;
+			break;
+		case 'a':
+			allocators_path = optarg;
+			break;
+		case 'w':
+			window = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			factor = strtod(optarg, NULL);
+			break;
+		default:
+			print_usage(argv);
+		}
+	}
+
+	if (optind == argc || !window || factor <= 1)
+		print_usage(argv);
+
+	grow_groups();
+	for (; optind < argc; optind++)
+		read_path(argv[optind]);
+
+	sort_groups();
+
+	stream = open_output(output);
+	write_groups(stream);
+	if (stream != stdout)
+		fclose(stream);
+
+	if (steps) {
+		stream = open_output(steps);
+		write_steps(stream, window, factor);
+		fclose(stream);
+	}
+
+	fprintf(stderr, "%llu samples, %zu tests and sizes", records_count,
+		groups_count);
+	if (calibration_ns)
+		fprintf(stderr, ", %.3f cycles per ns",
+			(double)calibration_cycles / calibration_ns);
+	fprintf(stderr, "\n");
+
+	return EXIT_SUCCESS;
+}
@@ -70,6 +70,8 @@ check_return `awk 'END {print $2}' $TEMP`
 echo -e "\n\n\n\nResults : \n"
 echo "Master time : $MASTER_TIME s"
 echo "LKMA time : $LKMA_TIME s"
+echo "LKMA overhead : $(awk -v m=$MASTER_TIME -v l=$LKMA_TIME \
+    'BEGIN {printf "%.2f s (%.2f %%)", l - m, (l - m) * 100 / m}')"
 
 echo "$MASTER_TIME $LKMA_TIME" > ${RESULT_FOLDER}/$(date +"%Y_%m_%d:%H:%M:%S")
 
@@ -10,4 +10,6 @@ END {
     print "\n\nAverage"
     print "Master : " (master / counts) " s"
     print "LKMA   : " (lkma / counts) " s"
+    printf "Overhead : %.2f s (%.2f %%)\n", (lkma - master) / counts,
+           (lkma - master) * 100 / master
 }
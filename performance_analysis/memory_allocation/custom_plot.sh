@@ -70,7 +70,7 @@ function plot(){
     for i in $(seq 0 1 ${#NAMES[@]})
     do
         plot_cmd="$plot_cmd \
-                  \"${FILES[$i]}\"  using 1:2 title \"${NAMES[$i]}\" smooth bezier with lines lw 3"
+                  \"${FILES[$i]}\"  using 1:2 title \"${NAMES[$i]}\" with lines lw 3"
         if [ $i -eq ${#NAMES[@]} ]
         then
             plot_cmd="$plot_cmd;"
@@ -0,0 +1,33 @@
+#!/usr/bin/awk -f
+
+# Decode the binary results of lkma_performance into the text format of its
+# proc entry, one line per sample. The records are read through
+# "od -An -v -w32 -t u4 --endian=little" and the allocator names from the
+# allocators file.
+
+BEGIN {
+    while ((getline line < names) > 0) {
+        split(line, fields, " ")
+        alloc_name[fields[1]] = fields[2]
+        free_name[fields[1]] = fields[3]
+    }
+}
+
+NF == 8 {
+    allocator = $1 % 65536
+    kind = int($1 / 65536)
+    size = $3 + $4 * 4294967296
+    cycles = $7 + $8 * 4294967296
+
+    if (kind == 2) {
+        printf("# cycles %.0f ns %.0f\n", cycles, size)
+        next
+    }
+
+    if (kind == 0)
+        name = alloc_name[allocator]
+    else
+        name = free_name[allocator]
+
+    printf("Test %s %.0f.......%.0f\n", name, size, cycles)
+}
@@ -1,7 +1,8 @@
 #!/bin/bash
 
 #set -x
-temp=.temp
+AGGREGATOR_DIR=../aggregator
+AGGREGATE=$AGGREGATOR_DIR/aggregate
 
 function sanity_checks(){
     local data_dir=$1;
@@ -13,6 +14,8 @@ function sanity_checks(){
     fi
 
     DATA=$data_dir
+    SUMMARY=$data_dir/summary.csv
+    STEPS=$data_dir/steps.csv
     IMAGE_DATA=$data_dir/image_data
     IMAGES=$data_dir/images
 }
@@ -29,7 +32,9 @@ plot(){
                     set format y \"%.0s%c\"; \
                     set xlabel \"Allocated size\"; \
                     set ylabel \"Run Time (cycles)\"; \
-                    plot \"$file\"  using 1:2 title \"$(echo $file | awk -F '/' '{print $NF}')\" smooth bezier with lines lw 5;\
+                    plot \"$file\" using 1:2 title \"median\" with lines lw 3, \
+                         \"$file\" using 1:3 title \"p90\" with lines lw 1, \
+                         \"$file\" using 1:4 title \"p99\" with lines lw 1;\
                     quit"
 
     gnuplot <<< $plot_cmd
@@ -37,17 +42,31 @@ plot(){
 
 sanity_checks $1
 
+make -s -C $AGGREGATOR_DIR
+if ! [[ $? -eq 0 ]]
+then
+    exit 1
+fi
+
 mkdir -p $IMAGE_DATA
 mkdir -p $IMAGES
 
-./parse_results.awk -v image_data=$IMAGE_DATA $DATA/*.data
+# The other directories only add their tests, as the kernel ones for the
+# kernel to module ratios
+$AGGREGATE -o $SUMMARY -s $STEPS "$@"
+if ! [[ $? -eq 0 ]]
+then
+    exit 1
+fi
+
+# One "<size> <median> <p90> <p99>" file per test, sorted by size
+rm -f $IMAGE_DATA/*
+awk -F ',' -v image_data=$IMAGE_DATA \
+    'NR > 1 {print $2 " " $5 " " $6 " " $7 > image_data"/"$1}' $SUMMARY
 
 for file in $IMAGE_DATA/*
 do
-    sort -h $file > $temp
-    ./filter_results.awk $temp > $file
     plot $file
 done
 
-rm $temp
 #set +x
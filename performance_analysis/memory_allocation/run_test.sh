@@ -16,6 +16,9 @@ KERNEL_SOURCES=/usr/src/linux_3.9
 KERNEL_CONFIG=`pwd`/config
 MODULE=lkma_performance
 PROC_ENTRY=/proc/lkma_performance
+DEBUGFS_DIR=/sys/kernel/debug/lkma_performance
+RESULTS=$DEBUGFS_DIR/results
+ALLOCATORS=$DEBUGFS_DIR/allocators
 BRANCH=master
 MODULE_RESULTS_DIR="data/module"
 KERNEL_RESULTS_DIR="data/kernel"
@@ -24,6 +27,8 @@ LOWER_LIMIT=$(( 0 * $MB ))
 #LOWER_LIMIT=$(cat $LAST_SUCCESS)
 UPPER_LIMIT=$(( 90 * $MB ))
 STEP=$(( 1 * $KB ))
+WARMUP=10
+ITERATIONS=100
 
 function check_return(){
     local return_value=$1
@@ -58,6 +63,12 @@ function sanity_checks(){
         echo "Missing proc entry : $PROC_ENTRY" 1>&2
         exit 1
     fi
+
+    if ! [[ -f $RESULTS ]]
+    then
+        echo "Missing debugfs entry : $RESULTS, is debugfs mounted ?" 1>&2
+        exit 1
+    fi
 }
 
 function mb(){
@@ -136,11 +147,8 @@ function get_stats(){
     local upper=$2;
     local step=$3;
     local kernel_test=$4
-    local mid=$(( ($lower + $upper) / 2 ));
     local result_dir=""
     local filename="";
-    local result="";
-    local test_name="$lower $upper $step"
 
     if [[ $kernel_test -eq 1 ]]
     then
@@ -149,35 +157,27 @@ function get_stats(){
         result_dir=$MODULE_RESULTS_DIR
     fi
 
-    filename=${result_dir}/${lower}_${upper}_${step}_${RANDOM}.data;
+    filename=${result_dir}/${lower}_${upper}_${step}_${RANDOM};
 
-    echo "$lower $upper $step $kernel_test" > $PROC_ENTRY
+    echo "$lower $upper $step $kernel_test $WARMUP $ITERATIONS" > $PROC_ENTRY
     if ! [[ $? -eq 0 ]]
     then
         echo "Failed to write to : $PROC_ENTRY";
         exit 1
     fi
 
-    cat "${PROC_ENTRY}" > $filename
-
+    # The whole sweep comes in one read, whatever its length
+    cat "${RESULTS}" > $filename.bin
     if ! [[ $? -eq 0 ]]
     then
-        rm $filename
+        rm $filename.bin
         print_test_result $lower $upper $step "failed" $kernel_test
-
-        if [[ $step -le 3 ]]
-        then
-            echo "Step is $step :("
-            exit 1
-        fi
-
-        sleep 1
-        get_stats $lower $mid $step $kernel_test
-        sleep 1
-        get_stats $mid $upper $step $kernel_test
-    else
-        print_test_result $lower $upper $step "passed" $kernel_test
+        exit 1
     fi
+
+    od -An -v -w32 -t u4 --endian=little $filename.bin | \
+        ./decode_results.awk -v names=$result_dir/allocators > $filename.data
+    print_test_result $lower $upper $step "passed" $kernel_test
 }
 
 function generic_test(){
@@ -204,15 +204,11 @@ sanity_checks
 
 mkdir -p $MODULE_RESULTS_DIR
 mkdir -p $KERNEL_RESULTS_DIR
+cat $ALLOCATORS > $MODULE_RESULTS_DIR/allocators
+cat $ALLOCATORS > $KERNEL_RESULTS_DIR/allocators
 
-for st_interval in $(seq $LOWER_LIMIT $MB $UPPER_LIMIT)
-do
-    if [[ $(( st_interval + MB )) -lt $(( 4 * MB )) ]]
-    then
-        generic_test $st_interval $(( $st_interval + $MB )) 100
-    else
-        generic_test $st_interval $(( $st_interval + $MB )) $STEP
-    fi
-done
+# Small sizes with a finer step
+generic_test $LOWER_LIMIT $(( 3 * $MB )) 100
+generic_test $(( 3 * $MB )) $UPPER_LIMIT $STEP
 
 #set +x
@@ -0,0 +1,124 @@
+#!/usr/bin/awk -f
+
+# Compare the results of run_qemu.sh for a master kernel (first file) and a
+# LKMA kernel (second file). Input lines are
+#   <run> <M|K> Test <allocator> <size>.......<median> <min> <p90> <p99> <max>
+# Each run of an allocator is summarized by the geometric mean of its
+# medians, the overhead of LKMA is the ratio of the means of these summaries,
+# with a 95% confidence interval from a Welch t-test in log space.
+# The exit status is 1 when the lower bound of an interval is above
+# threshold percent.
+
+BEGIN {
+    if (threshold == "")
+        threshold = 10
+
+    # Two-sided 95% quantiles of the t distribution
+    split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 2.262 2.228 " \
+          "2.201 2.179 2.160 2.145 2.131 2.120 2.110 2.101 2.093 2.086 " \
+          "2.080 2.074 2.069 2.064 2.060 2.056 2.052 2.048 2.045 2.042", t95)
+    failed = 0
+}
+
+FNR == 1 {
+    side++
+}
+
+$3 != "Test" || NF < 6 {
+    next
+}
+
+{
+    split($5, fields, /\.+/)
+    median = fields[2]
+    if (median <= 0)
+        next
+
+    allocator = $4 (($2 == "K") ? " (kernel)" : "")
+    allocators[allocator] = 1
+
+    key = side SUBSEP allocator SUBSEP $1
+    if (!(key in count))
+        runs[side, allocator]++
+    logsum[key] += log(median)
+    count[key]++
+}
+
+function t_quantile(df) {
+    df = int(df)
+    if (df < 1)
+        df = 1
+    return (df in t95) ? t95[df] : 1.96
+}
+
+# Mean and variance of the per run log geometric means of a side
+function summarize(s, allocator,    key, parts, x, n, sum, sumsq) {
+    n = sum = sumsq = 0
+    for (key in count) {
+        split(key, parts, SUBSEP)
+        if (parts[1] != s || parts[2] != allocator)
+            continue
+        x = logsum[key] / count[key]
+        n++
+        sum += x
+        sumsq += x * x
+    }
+    mean[s] = n ? sum / n : 0
+    var[s] = (n > 1) ? (sumsq - sum * sum / n) / (n - 1) : 0
+    if (var[s] < 0)
+        var[s] = 0
+    samples[s] = n
+}
+
+END {
+    if (side != 2) {
+        print "Usage : compare_results.awk <master> <lkma>" > "/dev/stderr"
+        exit 1
+    }
+
+    printf "%-28s %10s %10s %9s %21s %s\n", "# Allocator", "Master",
+           "LKMA", "Overhead", "95% CI", "Verdict"
+
+    for (allocator in allocators) {
+        summarize(1, allocator)
+        summarize(2, allocator)
+
+        if (!samples[1] || !samples[2]) {
+            printf "%-28s %10s %10s %9s %21s %s\n", allocator, "-", "-",
+                   "-", "-", "MISSING"
+            continue
+        }
+
+        d = mean[2] - mean[1]
+        se1 = var[1] / samples[1]
+        se2 = var[2] / samples[2]
+        se = sqrt(se1 + se2)
+
+        # Welch-Satterthwaite degrees of freedom
+        if (se > 0 && samples[1] > 1 && samples[2] > 1)
+            df = (se1 + se2) ^ 2 / (se1 ^ 2 / (samples[1] - 1) + \
+                                    se2 ^ 2 / (samples[2] - 1))
+        else
+            df = 1
+        margin = t_quantile(df) * se
+
+        overhead = (exp(d) - 1) * 100
+        low = (exp(d - margin) - 1) * 100
+        high = (exp(d + margin) - 1) * 100
+
+        if (low > threshold) {
+            verdict = "FAIL"
+            failed = 1
+        } else if (high > threshold) {
+            verdict = "UNSURE"
+        } else {
+            verdict = "PASS"
+        }
+
+        printf "%-28s %10.0f %10.0f %+8.2f%% [%+8.2f%%, %+8.2f%%] %s\n",
+               allocator, exp(mean[1]), exp(mean[2]), overhead, low, high,
+               verdict
+    }
+
+    exit failed
+}
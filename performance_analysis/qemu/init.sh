@@ -0,0 +1,76 @@
+#!/bin/sh
+
+# /init of the initramfs built by run_qemu.sh. It runs the lkma_performance
+# sweeps, writes the results to the second serial port and powers off. The
+# sweep is configured from the kernel command line.
+
+/bin/busybox --install -s /bin
+
+mount -t proc proc /proc
+mount -t sysfs sysfs /sys
+mount -t debugfs debugfs /sys/kernel/debug
+mount -t devtmpfs devtmpfs /dev 2> /dev/null || mknod /dev/ttyS1 c 4 65
+
+# Defaults, overridden by lkma_<name>=<value> on the command line
+RUNS=5
+LOWER=1
+UPPER=65536
+STEP=512
+WARMUP=10
+ITERATIONS=100
+LKMA_TEST=0
+
+for arg in $(cat /proc/cmdline)
+do
+    case $arg in
+        lkma_runs=*) RUNS=${arg#*=} ;;
+        lkma_lower=*) LOWER=${arg#*=} ;;
+        lkma_upper=*) UPPER=${arg#*=} ;;
+        lkma_step=*) STEP=${arg#*=} ;;
+        lkma_warmup=*) WARMUP=${arg#*=} ;;
+        lkma_iterations=*) ITERATIONS=${arg#*=} ;;
+        lkma_test=*) LKMA_TEST=${arg#*=} ;;
+    esac
+done
+
+OUT=/dev/ttyS1
+PROC_ENTRY=/proc/lkma_performance
+
+if ! insmod /lib/modules/lkma_performance.ko
+then
+    echo "@@ ERROR insmod lkma_performance" > $OUT
+    poweroff -f
+fi
+
+for run in $(seq 1 $RUNS)
+do
+    for kernel_test in 0 1
+    do
+        if [ $kernel_test -eq 1 ]
+        then
+            kind=K
+        else
+            kind=M
+        fi
+
+        echo "$LOWER $UPPER $STEP $kernel_test $WARMUP $ITERATIONS" > $PROC_ENTRY
+        sed "s/^/$run $kind /" $PROC_ENTRY > $OUT
+    done
+done
+
+# lkma_test checks the accounting of the LKMA kernel when it is loaded
+if [ $LKMA_TEST -eq 1 ]
+then
+    if insmod /lib/modules/lkma_test.ko stress_threads=$(nproc)
+    then
+        failed=$(dmesg | grep -c "Test .* failed")
+        echo "@@ LKMA_TEST failed $failed" > $OUT
+        rmmod lkma_test
+    else
+        echo "@@ ERROR insmod lkma_test" > $OUT
+    fi
+fi
+
+echo "@@ DONE" > $OUT
+sync
+poweroff -f
@@ -0,0 +1,187 @@
+#!/bin/bash
+
+# Compare the allocation costs of a master kernel and of a LKMA kernel, both
+# booted headless under QEMU with an initramfs. Each kernel runs the
+# lkma_performance sweeps RUNS times, the LKMA one also runs lkma_test. The
+# script fails when the LKMA overhead is above THRESHOLD percent with 95%
+# confidence or when lkma_test fails.
+#
+# Usage: ./run_qemu.sh <master kernel tree> <lkma kernel tree>
+#
+# Both trees have to be built already, with CONFIG_LKMA_KERNEL_TEST=y and
+# CONFIG_DEBUG_FS. Nothing is downloaded, busybox has to be installed and
+# statically linked.
+
+#set -x
+
+# Configs
+QEMU=${QEMU:-qemu-system-i386}
+BUSYBOX=${BUSYBOX:-$(which busybox)}
+MEMORY=1024
+TIMEOUT=3600
+RUNS=5
+LOWER_LIMIT=1
+UPPER_LIMIT=65536
+STEP=512
+WARMUP=10
+ITERATIONS=100
+THRESHOLD=10
+
+SCRIPT_DIR=$(cd $(dirname $0) && pwd)
+MODULES_DIR=$SCRIPT_DIR/../../modules
+COMPARE_RESULTS=$SCRIPT_DIR/compare_results.awk
+WORK_DIR=`pwd`/qemu_work
+RESULT_FOLDER=`pwd`/results/$(date +"%Y_%m_%d:%H:%M:%S")
+
+function check_return(){
+    local return_value=$1
+
+    if ! [[ $return_value -eq 0 ]]
+    then
+        exit 1
+    fi
+}
+
+function sanity_checks(){
+    local kernel
+
+    for kernel in $MASTER_KERNEL $LKMA_KERNEL
+    do
+        if ! [[ -f $kernel/arch/x86/boot/bzImage ]]
+        then
+            echo "No built kernel in : '$kernel'" 1>&2
+            exit 1
+        fi
+    done
+
+    if ! [[ -x $BUSYBOX ]]
+    then
+        echo "Missing busybox, set BUSYBOX" 1>&2
+        exit 1
+    fi
+
+    if ! which $QEMU > /dev/null
+    then
+        echo "Missing $QEMU, set QEMU" 1>&2
+        exit 1
+    fi
+}
+
+# KVM when it is usable, TCG otherwise
+function accel_flags(){
+    if [[ -w /dev/kvm ]]
+    then
+        echo "-enable-kvm"
+    fi
+}
+
+# Build the modules out of the source tree, against a kernel tree
+function build_modules(){
+    local kernel=$1
+    local build_dir=$2
+    local module
+
+    for module in lkma_performance lkma_test
+    do
+        mkdir -p $build_dir
+        cp -r $MODULES_DIR/$module $build_dir
+        make -C $kernel M=$build_dir/$module modules > /dev/null
+        check_return $?
+    done
+}
+
+function build_initramfs(){
+    local build_dir=$1
+    local root=$build_dir/root
+
+    rm -rf $root
+    mkdir -p $root/bin $root/dev $root/proc $root/sys $root/lib/modules
+    cp $BUSYBOX $root/bin/busybox
+    ln -s busybox $root/bin/sh
+    cp $SCRIPT_DIR/init.sh $root/init
+    chmod +x $root/init
+    cp $build_dir/lkma_performance/lkma_performance.ko $root/lib/modules
+    cp $build_dir/lkma_test/lkma_test.ko $root/lib/modules
+
+    (cd $root && find . | cpio -o -H newc 2> /dev/null | gzip) \
+        > $build_dir/initramfs.gz
+    check_return $?
+}
+
+function boot(){
+    local kernel=$1
+    local build_dir=$2
+    local lkma_test=$3
+    local results=$4
+
+    timeout $TIMEOUT $QEMU $(accel_flags) -m $MEMORY \
+        -kernel $kernel/arch/x86/boot/bzImage \
+        -initrd $build_dir/initramfs.gz \
+        -append "console=ttyS0 panic=-1 quiet lkma_runs=$RUNS \
+lkma_lower=$LOWER_LIMIT lkma_upper=$UPPER_LIMIT lkma_step=$STEP \
+lkma_warmup=$WARMUP lkma_iterations=$ITERATIONS lkma_test=$lkma_test" \
+        -display none -no-reboot -net none \
+        -serial file:$build_dir/console.log \
+        -serial file:$results
+
+    if ! grep -q "^@@ DONE" $results
+    then
+        echo "The run did not complete, see $build_dir/console.log" 1>&2
+        exit 1
+    fi
+
+    if grep "^@@ ERROR" $results 1>&2
+    then
+        exit 1
+    fi
+}
+
+function generic_test(){
+    local name=$1
+    local kernel=$2
+    local lkma_test=$3
+    local build_dir=$WORK_DIR/$name
+
+    printf "Build %s ......" $name
+    build_modules $kernel $build_dir
+    build_initramfs $build_dir
+    printf "OK\n"
+
+    printf "Boot %s ......" $name
+    boot $kernel $build_dir $lkma_test $RESULT_FOLDER/$name
+    printf "OK\n"
+}
+
+if ! [[ $# -eq 2 ]]
+then
+    echo "Usage : $0 <master kernel tree> <lkma kernel tree>" 1>&2
+    exit 1
+fi
+
+MASTER_KERNEL=$(cd $1 && pwd)
+LKMA_KERNEL=$(cd $2 && pwd)
+
+sanity_checks
+
+rm -rf $WORK_DIR
+mkdir -p $RESULT_FOLDER
+
+generic_test master $MASTER_KERNEL 0
+generic_test lkma $LKMA_KERNEL 1
+
+failed=$(awk '/^@@ LKMA_TEST/ {print $NF}' $RESULT_FOLDER/lkma)
+if ! [[ $failed -eq 0 ]]
+then
+    echo "lkma_test : $failed tests failed" 1>&2
+fi
+
+$COMPARE_RESULTS -v threshold=$THRESHOLD \
+    $RESULT_FOLDER/master $RESULT_FOLDER/lkma | tee $RESULT_FOLDER/verdict
+verdict=${PIPESTATUS[0]}
+
+if ! [[ $verdict -eq 0 && $failed -eq 0 ]]
+then
+    exit 1
+fi
+
+#set +x
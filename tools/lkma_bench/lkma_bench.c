@@ -0,0 +1,437 @@
+/**
+ * Benchmark of the LKMA attribution path in userspace.
+ *
+ * Builds the trie from a "nm -ln vmlinux" dump and replays an allocation
+ * trace from several threads, each pinned on a CPU, through one of the
+ * routines the kernel runs on each allocation. Prints the time and the cache
+ * misses per operation of each thread.
+ *
+ * Usage : lkma_bench [-t threads] [-r repeat] [-m mode] [-l layout]
+ *                    [-p prefix] [-T trace] [-n count] <nm dump>
+ * @author Ghennadi Procopciuc
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include "lkma_trie.h"
+#include "lkma_trace.h"
+
+#define NS_PER_SEC		1000000000ULL
+#define DEFAULT_OPS		(1 << 20)
+#define DEFAULT_REPEAT		10
+#define MAX_MISMATCHES		10
+
+/**
+ * enum mode - Routine replayed
+ * @MODE_ADD:    lkma_add_memory, as kallsyms_add_memory on each allocation
+ * @MODE_LOOKUP: lkma_file_node alone, to compare the layouts
+ * @MODE_MM:     lkma_from_mm_tree, as get_previous_function on each frame
+ * @MODE_REPORT: lkma_add_memory, with a reader computing the totals of the
+ *               whole trie in a loop, as lkma does when it is polled
+ */
+enum mode {
+	MODE_ADD,
+	MODE_LOOKUP,
+	MODE_MM,
+	MODE_REPORT,
+};
+
+static const char *mode_names[] = {"add", "lookup", "mm", "report"};
+
+/**
+ * struct bench_thread - Replay of the trace by one thread
+ * @thread: Thread
+ * @id:     Thread index, the replay starts at a different offset
+ * @cpu:    CPU the thread is pinned on
+ * @ops:    Operations done
+ * @ns:     Time taken by the operations
+ * @misses: Cache misses, -1 if the counter is unavailable
+ * @sink:   Results of the lookups, so they are not optimized away
+ */
+struct bench_thread {
+	pthread_t thread;
+	unsigned int id;
+	int cpu;
+	unsigned long long ops;
+	unsigned long long ns;
+	long long misses;
+	unsigned long sink;
+};
+
+static struct lkma_trie trie;
+static struct lkma_trace trace;
+static enum mode mode = MODE_ADD;
+static unsigned int threads_num = 1;
+static unsigned int repeat = DEFAULT_REPEAT;
+
+static pthread_barrier_t start_barrier;
+static volatile int replay_done;
+
+/* Reports made by the reader of MODE_REPORT and their duration */
+static unsigned long long reports;
+static unsigned long long reports_ns;
+
+static void print_usage(char **argv)
+{
+	fprintf(stderr, "Usage : %s [-t threads] [-r repeat] "
+		"[-m add|lookup|mm|report] [-l eytzinger|sorted] "
+		"[-p prefix] [-T trace] [-n count] <nm dump>\n", argv[0]);
+	exit(EXIT_FAILURE);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/* Counter of the cache misses of the calling thread, -1 if unavailable */
+static int open_misses_counter(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void pin_thread(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+		fprintf(stderr, "Unable to pin a thread on CPU %d\n", cpu);
+}
+
+static void replay(struct bench_thread *bench)
+{
+	unsigned long start = trace.count / threads_num * bench->id;
+	unsigned long i, j;
+	struct lkma_op *op;
+
+	for (i = 0; i < repeat; i++) {
+		for (j = 0; j < trace.count; j++) {
+			op = &trace.ops[(start + j) % trace.count];
+
+			switch (mode) {
+			case MODE_ADD:
+			case MODE_REPORT:
+				lkma_add_memory(&trie, op->caller, op->size);
+				break;
+			case MODE_LOOKUP:
+				bench->sink += lkma_file_node(&trie,
+							      op->caller);
+				break;
+			case MODE_MM:
+				bench->sink += lkma_from_mm_tree(&trie,
+								 op->caller);
+				break;
+			}
+		}
+	}
+
+	bench->ops = (unsigned long long)repeat * trace.count;
+}
+
+/* Compute the totals of the whole trie until the writers are done */
+static void report_loop(void)
+{
+	struct lkma_report report;
+	unsigned long long start;
+	long sink = 0;
+
+	if (lkma_report_init(&report, &trie)) {
+		fprintf(stderr, "Unable to allocate the report\n");
+		exit(EXIT_FAILURE);
+	}
+
+	while (!replay_done) {
+		start = now_ns();
+		lkma_start_report(&trie, &report);
+		sink += lkma_get_node_value(&trie, &report, 0);
+		reports_ns += now_ns() - start;
+		reports++;
+	}
+
+	lkma_report_destroy(&report);
+	(void)sink;
+}
+
+static void *bench_thread_fn(void *data)
+{
+	struct bench_thread *bench = data;
+	unsigned long long start;
+	int fd;
+
+	pin_thread(bench->cpu);
+	fd = open_misses_counter();
+
+	pthread_barrier_wait(&start_barrier);
+
+	/* The last thread reads while the others write */
+	if (mode == MODE_REPORT && bench->id == threads_num) {
+		report_loop();
+		return NULL;
+	}
+
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	start = now_ns();
+	replay(bench);
+	bench->ns = now_ns() - start;
+
+	bench->misses = -1;
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd, &bench->misses, sizeof(bench->misses)) !=
+		    sizeof(bench->misses))
+			bench->misses = -1;
+		close(fd);
+	}
+
+	return NULL;
+}
+
+static void print_thread(const struct bench_thread *bench)
+{
+	printf("Thread %u CPU %d.......%.2f ns/op", bench->id, bench->cpu,
+	       (double)bench->ns / bench->ops);
+	if (bench->misses >= 0)
+		printf(" %.3f misses/op", (double)bench->misses / bench->ops);
+	printf("\n");
+}
+
+/*
+ * Each counter has to end where a serial replay of the same operations into
+ * a second set of counters ends. The threads replay the whole trace repeat
+ * times each, so the serial replay adds every operation once, scaled.
+ */
+static int check_totals(void)
+{
+	struct lkma_trie serial;
+	long runs = (long)repeat * threads_num;
+	long size, expected, total = 0;
+	unsigned long i, mismatches = 0;
+
+	memcpy(&serial, &trie, sizeof(serial));
+	serial.sizes = calloc(trie.nodes_num, sizeof(*serial.sizes));
+	serial.stamps = calloc(trie.nodes_num, sizeof(*serial.stamps));
+	serial.peaks = calloc(trie.nodes_num, sizeof(*serial.peaks));
+	if (!serial.sizes || !serial.stamps || !serial.peaks) {
+		fprintf(stderr, "Unable to allocate the serial counters\n");
+		mismatches = 1;
+		goto out;
+	}
+	lkma_trie_reset(&serial);
+
+	for (i = 0; i < trace.count; i++)
+		lkma_add_memory(&serial, trace.ops[i].caller,
+				trace.ops[i].size * runs);
+
+	for (i = 0; i < trie.nodes_num; i++) {
+		size = atomic_load(&trie.sizes[i]);
+		expected = atomic_load(&serial.sizes[i]);
+		total += size;
+		if (size != expected && mismatches++ < MAX_MISMATCHES)
+			fprintf(stderr, "Node %s %ld bytes, %ld expected\n",
+				lkma_node_name(&trie, i), size, expected);
+	}
+
+	size = atomic_load(&trie.modules_size);
+	expected = atomic_load(&serial.modules_size);
+	total += size;
+	if (size != expected && mismatches++ < MAX_MISMATCHES)
+		fprintf(stderr, "Modules %ld bytes, %ld expected\n", size,
+			expected);
+
+	printf("Total %ld bytes.......%s\n", total,
+	       mismatches ? "failed" : "passed");
+
+out:
+	free(serial.sizes);
+	free((void *)serial.stamps);
+	free(serial.peaks);
+	return mismatches ? -1 : 0;
+}
+
+static int parse_mode(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); i++)
+		if (!strcmp(name, mode_names[i]))
+			return i;
+
+	return -1;
+}
+
+static void load_trie(const char *path, const char *prefix)
+{
+	unsigned long long start = now_ns();
+	FILE *in = fopen(path, "r");
+
+	if (!in) {
+		fprintf(stderr, "Unable to open %s : %s\n", path,
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if (lkma_trie_load(&trie, in, prefix))
+		exit(EXIT_FAILURE);
+	fclose(in);
+
+	printf("# Trie %lu nodes %lu ranges %lu symbols, built in %.1f ms\n",
+	       trie.nodes_num, trie.ranges_num, trie.symbols_num,
+	       (now_ns() - start) / 1e6);
+}
+
+static void load_trace(const char *path, unsigned long count)
+{
+	FILE *in;
+
+	if (!path) {
+		lkma_trace_synthesize(&trace, &trie, count, 0);
+		printf("# Trace synthesized, %lu operations\n", trace.count);
+		return;
+	}
+
+	in = fopen(path, "r");
+	if (!in) {
+		fprintf(stderr, "Unable to open %s : %s\n", path,
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if (lkma_trace_load(&trace, in)) {
+		fprintf(stderr, "No allocation in %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	fclose(in);
+
+	printf("# Trace %s, %lu operations\n", path, trace.count);
+}
+
+int main(int argc, char **argv)
+{
+	const char *trace_path = NULL, *prefix = NULL;
+	unsigned long count = DEFAULT_OPS;
+	struct bench_thread *benches;
+	unsigned long long ops = 0, ns = 0;
+	unsigned int i, total_threads;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt, ret = EXIT_SUCCESS;
+
+	while ((opt = getopt(argc, argv, "t:r:m:l:p:T:n:")) != -1) {
+		switch (opt) {
+		case 't':
+			threads_num = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			repeat = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			if (parse_mode(optarg) < 0)
+				print_usage(argv);
+			mode = parse_mode(optarg);
+			break;
+		case 'l':
+			if (!strcmp(optarg, "sorted"))
+				trie.layout = LKMA_LAYOUT_SORTED;
+			else if (strcmp(optarg, "eytzinger"))
+				print_usage(argv);
+			break;
+		case 'p':
+			prefix = optarg;
+			break;
+		case 'T':
+			trace_path = optarg;
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			print_usage(argv);
+		}
+	}
+
+	if (optind != argc - 1 || !threads_num || !repeat || !count)
+		print_usage(argv);
+
+	opt = trie.layout;
+	load_trie(argv[optind], prefix);
+	trie.layout = opt;
+	load_trace(trace_path, count);
+
+	total_threads = threads_num + (mode == MODE_REPORT);
+	benches = calloc(total_threads, sizeof(*benches));
+	if (!benches) {
+		fprintf(stderr, "Unable to allocate the threads\n");
+		return EXIT_FAILURE;
+	}
+
+	pthread_barrier_init(&start_barrier, NULL, total_threads);
+
+	for (i = 0; i < total_threads; i++) {
+		benches[i].id = i;
+		benches[i].cpu = i % (cpus > 0 ? cpus : 1);
+		if (pthread_create(&benches[i].thread, NULL, bench_thread_fn,
+				   &benches[i])) {
+			fprintf(stderr, "Unable to create thread %u\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < threads_num; i++)
+		pthread_join(benches[i].thread, NULL);
+	replay_done = 1;
+	if (mode == MODE_REPORT)
+		pthread_join(benches[threads_num].thread, NULL);
+
+	printf("# Mode %s layout %s\n", mode_names[mode],
+	       trie.layout == LKMA_LAYOUT_SORTED ? "sorted" : "eytzinger");
+	for (i = 0; i < threads_num; i++) {
+		print_thread(&benches[i]);
+		ops += benches[i].ops;
+		if (benches[i].ns > ns)
+			ns = benches[i].ns;
+	}
+	printf("Threads %u.......%.0f ops/s\n", threads_num,
+	       (double)ops * NS_PER_SEC / ns);
+
+	if (mode == MODE_REPORT && reports)
+		printf("Reports %llu.......%.0f ns/report\n", reports,
+		       (double)reports_ns / reports);
+
+	if (mode == MODE_ADD || mode == MODE_REPORT)
+		if (check_totals())
+			ret = EXIT_FAILURE;
+
+	pthread_barrier_destroy(&start_barrier);
+	free(benches);
+	lkma_trace_destroy(&trace);
+	lkma_trie_destroy(&trie);
+
+	return ret;
+}
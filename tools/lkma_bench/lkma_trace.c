@@ -0,0 +1,232 @@
+/**
+ * Allocation traces replayed by lkma_bench.
+ *
+ * A trace is read from the kmem events of ftrace, as saved from
+ * /sys/kernel/debug/tracing/trace with the kmem:kmalloc*, kmem:kmem_cache_*
+ * and kmem:kfree events enabled, or from lines "a <caller> <size>" and
+ * "f <caller> <size>". Like LKMA, a free is charged to the caller of the
+ * allocation it releases.
+ * @author Ghennadi Procopciuc
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "lkma_trace.h"
+
+#define LINE_LEN		512
+#define MIN_OBJECTS		(1 << 16)
+
+/* Sizes of the synthesized allocations are 2^0 .. 2^(SYNTH_ORDERS - 1) */
+#define SYNTH_ORDERS		13
+/* Allocations live while at most SYNTH_LIVE others are made */
+#define SYNTH_LIVE		64
+
+/* Live object of a ftrace trace, found back by its pointer */
+struct object {
+	unsigned long long ptr;
+	unsigned long long caller;
+	long size;
+};
+
+/* Open addressing table of the live objects, ptr 0 marks a free slot */
+static struct object *objects;
+static unsigned long objects_size, objects_count;
+
+static void add_op(struct lkma_trace *trace, unsigned long long caller,
+		   long size)
+{
+	if (trace->count == trace->capacity) {
+		trace->capacity = trace->capacity ? 2 * trace->capacity : 4096;
+		trace->ops = realloc(trace->ops,
+				     trace->capacity * sizeof(*trace->ops));
+		if (!trace->ops) {
+			fprintf(stderr, "Unable to allocate the trace\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	trace->ops[trace->count].caller = caller;
+	trace->ops[trace->count].size = size;
+	trace->count++;
+}
+
+static unsigned long hash_ptr(unsigned long long ptr)
+{
+	ptr *= 0x9e3779b97f4a7c15ULL;
+
+	return (ptr ^ (ptr >> 32)) & (objects_size - 1);
+}
+
+static struct object *find_object(unsigned long long ptr)
+{
+	unsigned long i;
+
+	for (i = hash_ptr(ptr); objects[i].ptr;
+	     i = (i + 1) & (objects_size - 1))
+		if (objects[i].ptr == ptr)
+			return &objects[i];
+
+	return &objects[i];
+}
+
+static void grow_objects(void)
+{
+	struct object *old = objects;
+	unsigned long old_size = objects_size, i;
+
+	objects_size = objects_size ? 2 * objects_size : MIN_OBJECTS;
+	objects = calloc(objects_size, sizeof(*objects));
+	if (!objects) {
+		fprintf(stderr, "Unable to allocate the objects\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < old_size; i++)
+		if (old[i].ptr)
+			*find_object(old[i].ptr) = old[i];
+
+	free(old);
+}
+
+static void remove_object(struct object *object)
+{
+	unsigned long i = object - objects, j, home;
+
+	/* Backward shift, so that the probe sequences stay unbroken */
+	for (j = (i + 1) & (objects_size - 1); objects[j].ptr;
+	     j = (j + 1) & (objects_size - 1)) {
+		home = hash_ptr(objects[j].ptr);
+		if (((j - home) & (objects_size - 1)) >=
+		    ((j - i) & (objects_size - 1))) {
+			objects[i] = objects[j];
+			i = j;
+		}
+	}
+
+	objects[i].ptr = 0;
+	objects_count--;
+}
+
+static void trace_alloc(struct lkma_trace *trace, unsigned long long caller,
+			unsigned long long ptr, long size)
+{
+	struct object *object;
+
+	/* Failed allocations and ZERO_SIZE_PTR */
+	if (ptr < 4096 || size <= 0)
+		return;
+
+	if ((objects_count + 1) * 4 > objects_size * 3)
+		grow_objects();
+
+	object = find_object(ptr);
+	if (object->ptr) {
+		/* The free was not traced, drop the old object */
+		add_op(trace, object->caller, -object->size);
+		objects_count--;
+	}
+
+	object->ptr = ptr;
+	object->caller = caller;
+	object->size = size;
+	objects_count++;
+
+	add_op(trace, caller, size);
+}
+
+static void trace_free(struct lkma_trace *trace, unsigned long long ptr)
+{
+	struct object *object;
+
+	if (!objects_size)
+		return;
+
+	/* Objects allocated before the trace started are unknown */
+	object = find_object(ptr);
+	if (!object->ptr)
+		return;
+
+	add_op(trace, object->caller, -object->size);
+	remove_object(object);
+}
+
+/**
+ * lkma_trace_load - Read a trace
+ * @trace: Result
+ * @in:    ftrace output or "a|f <caller> <size>" lines
+ *
+ * Return: 0 on success, -1 if no operation was found
+ */
+int lkma_trace_load(struct lkma_trace *trace, FILE *in)
+{
+	unsigned long long caller, ptr;
+	unsigned long requested, allocated;
+	char line[LINE_LEN], kind;
+	const char *event;
+	long size;
+
+	memset(trace, 0, sizeof(*trace));
+
+	while (fgets(line, sizeof(line), in)) {
+		if (sscanf(line, " %c %llx %ld", &kind, &caller, &size) == 3 &&
+		    (kind == 'a' || kind == 'f')) {
+			add_op(trace, caller, kind == 'a' ? size : -size);
+			continue;
+		}
+
+		event = strstr(line, "call_site=");
+		if (!event)
+			continue;
+
+		if (sscanf(event, "call_site=%llx ptr=%llx bytes_req=%lu "
+			   "bytes_alloc=%lu", &caller, &ptr, &requested,
+			   &allocated) == 4)
+			trace_alloc(trace, caller, ptr, allocated);
+		else if (sscanf(event, "call_site=%llx ptr=%llx", &caller,
+				&ptr) == 2)
+			trace_free(trace, ptr);
+	}
+
+	free(objects);
+	objects = NULL;
+	objects_size = objects_count = 0;
+
+	return trace->count ? 0 : -1;
+}
+
+/**
+ * lkma_trace_synthesize - Build a trace from random text symbols
+ * @trace: Result
+ * @trie:  Trie whose symbols are the callers
+ * @count: Number of allocations
+ * @seed:  Seed of the random numbers
+ *
+ * Each allocation is freed after a few others, as most allocations from the
+ * kernel are short lived. The last SYNTH_LIVE ones are left allocated, so
+ * that the counters do not all end at 0.
+ */
+void lkma_trace_synthesize(struct lkma_trace *trace,
+			   const struct lkma_trie *trie, unsigned long count,
+			   unsigned int seed)
+{
+	struct lkma_op live[SYNTH_LIVE];
+	unsigned long i, slot;
+
+	memset(trace, 0, sizeof(*trace));
+	srand(seed);
+
+	for (i = 0; i < count; i++) {
+		slot = i % SYNTH_LIVE;
+		if (i >= SYNTH_LIVE)
+			add_op(trace, live[slot].caller, -live[slot].size);
+
+		live[slot].caller = trie->symbols[rand() % trie->symbols_num];
+		live[slot].size = 1L << (rand() % SYNTH_ORDERS);
+		add_op(trace, live[slot].caller, live[slot].size);
+	}
+}
+
+void lkma_trace_destroy(struct lkma_trace *trace)
+{
+	free(trace->ops);
+	memset(trace, 0, sizeof(*trace));
+}
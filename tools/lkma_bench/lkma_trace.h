@@ -0,0 +1,33 @@
+/**
+ * Allocation traces replayed by lkma_bench.
+ * @author Ghennadi Procopciuc
+ */
+#ifndef LKMA_TRACE_H
+#define LKMA_TRACE_H
+
+#include <stdio.h>
+#include "lkma_trie.h"
+
+/**
+ * struct lkma_op - One update of the counters
+ * @caller: Address of the caller charged
+ * @size:   Bytes allocated, negative for a free
+ */
+struct lkma_op {
+	unsigned long long caller;
+	long size;
+};
+
+struct lkma_trace {
+	struct lkma_op *ops;
+	unsigned long count;
+	unsigned long capacity;
+};
+
+int lkma_trace_load(struct lkma_trace *trace, FILE *in);
+void lkma_trace_synthesize(struct lkma_trace *trace,
+			   const struct lkma_trie *trie, unsigned long count,
+			   unsigned int seed);
+void lkma_trace_destroy(struct lkma_trace *trace);
+
+#endif /* LKMA_TRACE_H */
@@ -0,0 +1,800 @@
+/**
+ * Userspace build of the LKMA attribution path.
+ *
+ * The first half ports the trie generator of scripts/kallsyms.c, the second
+ * one the lookups and the counters of kernel/kallsyms.c and the subtree totals
+ * of modules/lkma/lkma.c. Keep them in sync with the kernel when the layout
+ * changes.
+ * @author Ghennadi Procopciuc
+ */
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lkma_trie.h"
+
+#define UNKNOWN_FILE		"unknown"
+#define LINE_LEN		500
+
+#define HASH_BITS		16
+#define HASH_SIZE		(1 << HASH_BITS)
+
+struct sym_entry {
+	unsigned long long addr;
+	char type;
+	char *sym;
+	struct trie_node *node;
+};
+
+/* @see struct trie_node from scripts/kallsyms.c */
+struct trie_node {
+	char *data;
+	struct trie_node *parent;
+	struct trie_node **children;
+	unsigned long children_num;
+	unsigned long children_max;
+	unsigned long id;
+	unsigned long first_child;
+	unsigned long name;
+};
+
+struct file_range {
+	unsigned long long addr;
+	struct trie_node *node;
+};
+
+struct hash_entry {
+	char *key;
+	struct trie_node *parent;
+	struct trie_node *node;
+	struct hash_entry *next;
+};
+
+/* State of the generator, only used while lkma_trie_load runs */
+static struct trie_node *trie_root;
+static struct hash_entry *children_hash[HASH_SIZE];
+static struct hash_entry *files_hash[HASH_SIZE];
+static struct hash_entry *names_hash[HASH_SIZE];
+static struct trie_node **trie_nodes;
+static unsigned int trie_nodes_cnt;
+static struct file_range *ranges;
+static unsigned int ranges_cnt;
+static struct sym_entry *table;
+static unsigned int table_size, table_cnt;
+
+static void *xmalloc(size_t size)
+{
+	void *ptr = malloc(size);
+
+	if (!ptr) {
+		fprintf(stderr, "lkma_trie failure: "
+			"unable to allocate required memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return ptr;
+}
+
+static struct trie_node *trie_init(void)
+{
+	struct trie_node *node = xmalloc(sizeof(*node));
+
+	node->data = NULL;
+	node->parent = NULL;
+	node->children = NULL;
+	node->children_num = 0;
+	node->children_max = 2;
+	node->id = -1;
+	trie_nodes_cnt++;
+
+	return node;
+}
+
+/* FNV-1a hash of a string mixed with a pointer */
+static unsigned int hash_string(const char *str, const void *seed)
+{
+	unsigned int hash = 2166136261u;
+	unsigned long key = (unsigned long)seed;
+
+	for (; *str != '\0'; str++) {
+		hash ^= (unsigned char)*str;
+		hash *= 16777619u;
+	}
+
+	hash ^= (unsigned int)(key ^ ((key >> 16) >> 16));
+	hash *= 16777619u;
+
+	return (hash ^ (hash >> HASH_BITS)) & (HASH_SIZE - 1);
+}
+
+static struct trie_node *hash_find(struct hash_entry **table,
+				   struct trie_node *parent, const char *key)
+{
+	struct hash_entry *entry;
+
+	entry = table[hash_string(key, parent)];
+	for (; entry != NULL; entry = entry->next)
+		if (entry->parent == parent && strcmp(entry->key, key) == 0)
+			return entry->node;
+
+	return NULL;
+}
+
+static void hash_add(struct hash_entry **table, struct trie_node *parent,
+		     char *key, struct trie_node *node)
+{
+	struct hash_entry *entry = xmalloc(sizeof(*entry));
+	unsigned int bucket = hash_string(key, parent);
+
+	entry->key = key;
+	entry->parent = parent;
+	entry->node = node;
+	entry->next = table[bucket];
+	table[bucket] = entry;
+}
+
+static void hash_destroy(struct hash_entry **table, int free_key)
+{
+	struct hash_entry *entry, *next;
+	int i;
+
+	for (i = 0; i < HASH_SIZE; i++) {
+		for (entry = table[i]; entry != NULL; entry = next) {
+			next = entry->next;
+			if (free_key)
+				free(entry->key);
+			free(entry);
+		}
+		table[i] = NULL;
+	}
+}
+
+static struct trie_node *trie_add_path(struct trie_node *trie, char *path)
+{
+	char *token;
+	char *full_path;
+	struct trie_node *current, *child;
+
+	current = hash_find(files_hash, NULL, path);
+	if (current != NULL)
+		return current;
+
+	full_path = strdup(path);
+	current = trie;
+
+	while ((token = strsep(&path, "/"))) {
+		if (*token == '\0')
+			continue;
+
+		child = hash_find(children_hash, current, token);
+		if (child != NULL) {
+			current = child;
+			continue;
+		}
+
+		child = trie_init();
+		child->data = strdup(token);
+		child->parent = current;
+
+		if (current->children_max == current->children_num ||
+		    current->children == NULL) {
+			if (current->children != NULL)
+				current->children_max *= 2;
+			current->children = realloc(current->children,
+					current->children_max *
+					sizeof(*current->children));
+			if (!current->children) {
+				perror("Unable to add path to the trie");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		current->children[current->children_num++] = child;
+		hash_add(children_hash, current, child->data, child);
+		current = child;
+	}
+
+	hash_add(files_hash, NULL, full_path, current);
+
+	return current;
+}
+
+static void trie_destroy(struct trie_node *node)
+{
+	unsigned long i;
+
+	for (i = 0; i < node->children_num; i++)
+		trie_destroy(node->children[i]);
+
+	free(node->data);
+	free(node->children);
+	free(node);
+}
+
+/* BFS ids, the children of a node are consecutive */
+static void trie_index_update(struct trie_node *trie)
+{
+	unsigned int head, tail = 0;
+	unsigned long i;
+	struct trie_node *node;
+
+	trie_nodes = xmalloc(sizeof(*trie_nodes) * trie_nodes_cnt);
+
+	trie_nodes[tail++] = trie;
+	for (head = 0; head < tail; head++) {
+		node = trie_nodes[head];
+		node->id = head;
+		node->first_child = tail;
+
+		for (i = 0; i < node->children_num; i++)
+			trie_nodes[tail++] = node->children[i];
+	}
+}
+
+/* Equal names share their offset in the names pool */
+static unsigned long trie_names_update(void)
+{
+	unsigned long size = 0;
+	unsigned int i;
+	struct trie_node *node, *same;
+
+	for (i = 0; i < trie_nodes_cnt; i++) {
+		node = trie_nodes[i];
+
+		same = hash_find(names_hash, NULL, node->data);
+		if (same != NULL) {
+			node->name = same->name;
+			continue;
+		}
+
+		node->name = size;
+		size += strlen(node->data) + 1;
+		hash_add(names_hash, NULL, node->data, node);
+	}
+
+	return size;
+}
+
+static void build_file_ranges(void)
+{
+	unsigned int i;
+
+	ranges = xmalloc(sizeof(*ranges) * (table_cnt + 1));
+
+	ranges_cnt = 0;
+	for (i = 0; i < table_cnt; i++) {
+		/* Absolute symbols are not relative to _text */
+		if (toupper(table[i].type) == 'A')
+			continue;
+
+		if (ranges_cnt > 0 &&
+		    ranges[ranges_cnt - 1].node == table[i].node)
+			continue;
+
+		ranges[ranges_cnt].addr = table[i].addr;
+		ranges[ranges_cnt].node = table[i].node;
+		ranges_cnt++;
+	}
+}
+
+static unsigned int eytzinger_order(unsigned int *order, unsigned int index,
+				    unsigned int slot, unsigned int n)
+{
+	if (slot <= n) {
+		index = eytzinger_order(order, index, 2 * slot, n);
+		order[slot] = index++;
+		index = eytzinger_order(order, index, 2 * slot + 1, n);
+	}
+
+	return index;
+}
+
+static int compare_symbols_name(const void *a, const void *b)
+{
+	const struct sym_entry *sa = a, *sb = b;
+
+	return strcmp(sa->sym, sb->sym);
+}
+
+static int compare_symbols_addr(const void *a, const void *b)
+{
+	const struct sym_entry *sa = a, *sb = b;
+
+	return (sa->addr > sb->addr) - (sa->addr < sb->addr);
+}
+
+/* A symbol defined several times takes the file of a known definition */
+static void resolve_unknown_sources(void)
+{
+	unsigned int i, j;
+	struct trie_node *node;
+
+	qsort(table, table_cnt, sizeof(*table), compare_symbols_name);
+
+	for (i = 0; i < table_cnt; i++) {
+		if (strcmp(table[i].node->data, UNKNOWN_FILE))
+			continue;
+
+		node = NULL;
+		for (j = i; j-- > 0 && !strcmp(table[j].sym, table[i].sym);)
+			if (strcmp(table[j].node->data, UNKNOWN_FILE)) {
+				node = table[j].node;
+				break;
+			}
+
+		for (j = i + 1; node == NULL && j < table_cnt &&
+		     !strcmp(table[j].sym, table[i].sym); j++)
+			if (strcmp(table[j].node->data, UNKNOWN_FILE))
+				node = table[j].node;
+
+		if (node != NULL)
+			table[i].node = node;
+	}
+}
+
+/*
+ * Lines are "<address> <type> <name>[\t<file>:<line>]", @prefix is removed
+ * from the start of the files.
+ */
+static int read_symbol(FILE *in, struct sym_entry *s, const char *prefix)
+{
+	char str[LINE_LEN];
+	char filename[LINE_LEN] = {};
+	char *file, *dots;
+	char c;
+	int rc;
+
+	rc = fscanf(in, "%llx %c %499[^\n\t]%c", &s->addr, &s->type, str, &c);
+	if (rc != 4) {
+		if (rc != EOF && fgets(str, LINE_LEN, in) == NULL)
+			fprintf(stderr, "Read error or end of file.\n");
+		return -1;
+	}
+
+	if (c == '\t' && fscanf(in, "%499[^\n]%c", filename, &c) < 1)
+		filename[0] = '\0';
+
+	/* ARM mapping symbols and undefined ones */
+	if ((str[0] == '$' && strchr("atd", str[1])) ||
+	    toupper(s->type) == 'U')
+		return -1;
+
+	dots = strrchr(filename, ':');
+	if (dots)
+		*dots = '\0';
+
+	file = filename;
+	if (prefix && !strncmp(file, prefix, strlen(prefix)))
+		file += strlen(prefix);
+	if (*file == '\0') {
+		strcpy(filename, UNKNOWN_FILE);
+		file = filename;
+	}
+
+	s->sym = strdup(str);
+	s->node = trie_add_path(trie_root, file);
+
+	return 0;
+}
+
+static void read_map(FILE *in, const char *prefix)
+{
+	while (!feof(in)) {
+		if (table_cnt >= table_size) {
+			table_size += 10000;
+			table = realloc(table, sizeof(*table) * table_size);
+			if (!table) {
+				fprintf(stderr, "out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		if (read_symbol(in, &table[table_cnt], prefix) == 0)
+			table_cnt++;
+	}
+}
+
+static int is_text_symbol(const struct sym_entry *s)
+{
+	return toupper(s->type) == 'T' || toupper(s->type) == 'W';
+}
+
+/* Serialize the trie as kallsyms_trie and kallsyms_trie_names */
+static void write_trie(struct lkma_trie *result)
+{
+	unsigned long names_size = trie_names_update();
+	struct trie_node *node;
+	unsigned int i;
+
+	result->nodes_num = trie_nodes_cnt;
+	result->nodes = xmalloc(sizeof(*result->nodes) * trie_nodes_cnt);
+	result->names = xmalloc(names_size + 1);
+
+	for (i = 0; i < trie_nodes_cnt; i++) {
+		node = trie_nodes[i];
+		result->nodes[i].name = node->name;
+		result->nodes[i].parent = node->parent ? node->parent->id : 0;
+		result->nodes[i].children = node->first_child;
+		result->nodes[i].children_num = node->children_num;
+		strcpy(result->names + node->name, node->data);
+	}
+}
+
+/* Serialize the intervals as kallsyms_ranges_addresses and _nodes */
+static void write_ranges(struct lkma_trie *result)
+{
+	unsigned int n = ranges_cnt + 1;
+	unsigned int *order;
+	unsigned int k, i;
+
+	order = xmalloc(sizeof(*order) * (n + 1));
+	eytzinger_order(order, 0, 1, n);
+
+	result->ranges_num = n;
+	result->ranges_addresses = xmalloc(sizeof(unsigned long long) *
+					   (n + 1));
+	result->ranges_nodes = xmalloc(sizeof(uint32_t) * (n + 1));
+	result->sorted_addresses = xmalloc(sizeof(unsigned long long) * n);
+	result->sorted_nodes = xmalloc(sizeof(uint32_t) * n);
+
+	result->ranges_addresses[0] = 0;
+	result->ranges_nodes[0] = 0;
+	for (k = 1; k <= n; k++) {
+		i = order[k];
+		result->ranges_addresses[k] = i == ranges_cnt ? ~0ULL :
+			ranges[i].addr;
+		result->ranges_nodes[k] = i ? ranges[i - 1].node->id : 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		result->sorted_addresses[i] = i == ranges_cnt ? ~0ULL :
+			ranges[i].addr;
+		result->sorted_nodes[i] = i ? ranges[i - 1].node->id : 0;
+	}
+
+	free(order);
+}
+
+static void write_symbols(struct lkma_trie *result)
+{
+	unsigned int i;
+
+	result->symbols = xmalloc(sizeof(unsigned long long) * (table_cnt + 1));
+	result->symbols_num = 0;
+	result->text_start = ~0ULL;
+	result->text_end = 0;
+
+	for (i = 0; i < table_cnt; i++) {
+		if (!is_text_symbol(&table[i]))
+			continue;
+
+		result->symbols[result->symbols_num++] = table[i].addr;
+		if (table[i].addr < result->text_start)
+			result->text_start = table[i].addr;
+		if (table[i].addr > result->text_end)
+			result->text_end = table[i].addr;
+	}
+}
+
+/**
+ * lkma_trie_load - Generate the tables from a "nm -ln" dump
+ * @result: Trie
+ * @in:     Dump of the symbols
+ * @prefix: Prefix of the source files, usually the kernel source directory
+ *
+ * Return: 0 on success, -1 if the dump has no symbol
+ */
+int lkma_trie_load(struct lkma_trie *result, FILE *in, const char *prefix)
+{
+	unsigned int i;
+
+	memset(result, 0, sizeof(*result));
+
+	trie_root = trie_init();
+	trie_root->data = strdup("");
+	read_map(in, prefix);
+
+	if (table_cnt == 0) {
+		fprintf(stderr, "No symbols\n");
+		return -1;
+	}
+
+	resolve_unknown_sources();
+	qsort(table, table_cnt, sizeof(*table), compare_symbols_addr);
+
+	build_file_ranges();
+	trie_index_update(trie_root);
+	write_trie(result);
+	write_ranges(result);
+	write_symbols(result);
+
+	result->sizes = calloc(result->nodes_num, sizeof(*result->sizes));
+	result->stamps = calloc(result->nodes_num, sizeof(*result->stamps));
+	result->peaks = calloc(result->nodes_num, sizeof(*result->peaks));
+	if (!result->sizes || !result->stamps || !result->peaks) {
+		fprintf(stderr, "lkma_trie failure: "
+			"unable to allocate required memory\n");
+		exit(EXIT_FAILURE);
+	}
+	atomic_init(&result->epoch, 1);
+
+	/* Release the generator state, the tables are self contained */
+	for (i = 0; i < table_cnt; i++)
+		free(table[i].sym);
+	free(table);
+	table = NULL;
+	table_cnt = table_size = 0;
+	free(ranges);
+	ranges = NULL;
+	ranges_cnt = 0;
+	free(trie_nodes);
+	trie_nodes = NULL;
+	hash_destroy(children_hash, 0);
+	hash_destroy(files_hash, 1);
+	hash_destroy(names_hash, 0);
+	trie_destroy(trie_root);
+	trie_root = NULL;
+	trie_nodes_cnt = 0;
+
+	return 0;
+}
+
+void lkma_trie_destroy(struct lkma_trie *trie)
+{
+	free(trie->nodes);
+	free(trie->names);
+	free(trie->ranges_addresses);
+	free(trie->ranges_nodes);
+	free(trie->sorted_addresses);
+	free(trie->sorted_nodes);
+	free(trie->symbols);
+	free(trie->sizes);
+	free((void *)trie->stamps);
+	free(trie->peaks);
+	memset(trie, 0, sizeof(*trie));
+}
+
+/* Clear the counters, as after a boot */
+void lkma_trie_reset(struct lkma_trie *trie)
+{
+	unsigned long i;
+
+	for (i = 0; i < trie->nodes_num; i++) {
+		atomic_store(&trie->sizes[i], 0);
+		atomic_store(&trie->stamps[i], 0);
+		atomic_store(&trie->peaks[i], 0);
+	}
+	atomic_store(&trie->epoch, 1);
+	atomic_store(&trie->modules_size, 0);
+}
+
+const char *lkma_node_name(const struct lkma_trie *trie, unsigned long node)
+{
+	return trie->names + trie->nodes[node].name;
+}
+
+bool lkma_is_ksym_addr(const struct lkma_trie *trie,
+		       unsigned long long address)
+{
+	return address >= trie->text_start && address <= trie->text_end;
+}
+
+/* @see kallsyms_file_node */
+static unsigned long eytzinger_file_node(const struct lkma_trie *trie,
+					 unsigned long long address)
+{
+	unsigned long k = 1;
+
+	while (k <= trie->ranges_num)
+		k = 2 * k + (trie->ranges_addresses[k] <= address);
+
+	/* Cancel the right turns taken after the last left one */
+	k >>= __builtin_ctzl(~k) + 1;
+
+	return trie->ranges_nodes[k];
+}
+
+/* First start greater than @address, in the sorted table */
+static unsigned long sorted_file_node(const struct lkma_trie *trie,
+				      unsigned long long address)
+{
+	unsigned long low = 0, high = trie->ranges_num - 1, middle;
+
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		if (trie->sorted_addresses[middle] <= address)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return trie->sorted_nodes[low];
+}
+
+/**
+ * lkma_file_node - Get the trie node of the file which defines @address
+ * @trie:    Trie
+ * @address: Kernel address
+ *
+ * Return: Id of the node or 0 if @address is not covered
+ */
+unsigned long lkma_file_node(const struct lkma_trie *trie,
+			     unsigned long long address)
+{
+	if (trie->layout == LKMA_LAYOUT_SORTED)
+		return sorted_file_node(trie, address);
+
+	return eytzinger_file_node(trie, address);
+}
+
+/* @see from_mm_tree */
+bool lkma_from_mm_tree(struct lkma_trie *trie, unsigned long long address)
+{
+	unsigned long file_node = 0;
+	unsigned long node;
+
+	if (lkma_is_ksym_addr(trie, address))
+		file_node = lkma_file_node(trie, address);
+
+	/* Function not found */
+	if (file_node == 0)
+		return false;
+
+	node = file_node;
+	if (trie->mm_node == 0 || trie->arch_mm_node == 0) {
+		while (node != 0) {
+			if (strcmp(lkma_node_name(trie, node), "mm") == 0) {
+				if (trie->mm_node == 0)
+					trie->mm_node = node;
+				else if (trie->arch_mm_node == 0 &&
+					 trie->mm_node != node)
+					trie->arch_mm_node = node;
+				return true;
+			}
+
+			node = trie->nodes[node].parent;
+		}
+		return false;
+	}
+
+	while (node != 0) {
+		if (node == trie->mm_node || node == trie->arch_mm_node)
+			return true;
+
+		node = trie->nodes[node].parent;
+	}
+
+	return false;
+}
+
+/* @see kallsyms_trie_touch */
+static void trie_touch(struct lkma_trie *trie, unsigned long node)
+{
+	unsigned int epoch;
+
+	for (;;) {
+		epoch = atomic_load(&trie->epoch);
+		if (atomic_load_explicit(&trie->stamps[node],
+					 memory_order_relaxed) == epoch)
+			break;
+
+		atomic_store_explicit(&trie->stamps[node], epoch,
+				      memory_order_relaxed);
+		if (node == 0)
+			break;
+
+		node = trie->nodes[node].parent;
+	}
+}
+
+/* @see kallsyms_trie_raise_peak */
+static void trie_raise_peak(struct lkma_trie *trie, unsigned long node,
+			    long value)
+{
+	long peak = atomic_load(&trie->peaks[node]);
+
+	while (value > peak &&
+	       !atomic_compare_exchange_weak(&trie->peaks[node], &peak, value))
+		;
+}
+
+/**
+ * lkma_add_memory - Count dynamically allocated memory for a file
+ * @trie:    Trie
+ * @address: Caller address
+ * @size:    Allocated size, negative for a free
+ *
+ * @see kallsyms_add_memory, the consistency checks are left out as they only
+ * print.
+ */
+void lkma_add_memory(struct lkma_trie *trie, unsigned long long address,
+		     long size)
+{
+	unsigned long node;
+	long value;
+
+	if (!lkma_is_ksym_addr(trie, address)) {
+		atomic_fetch_add(&trie->modules_size, size);
+		return;
+	}
+
+	node = lkma_file_node(trie, address);
+	if (node == 0)
+		return;
+
+	/* Full barrier, the counter is updated before the stamps */
+	value = atomic_fetch_add(&trie->sizes[node], size) + size;
+	trie_touch(trie, node);
+
+	if (size > 0)
+		trie_raise_peak(trie, node, value);
+}
+
+int lkma_report_init(struct lkma_report *report,
+		     const struct lkma_trie *trie)
+{
+	report->values = calloc(trie->nodes_num, sizeof(*report->values));
+	report->epochs = calloc(trie->nodes_num, sizeof(*report->epochs));
+	report->epoch = 0;
+
+	if (!report->values || !report->epochs) {
+		lkma_report_destroy(report);
+		return -1;
+	}
+
+	return 0;
+}
+
+void lkma_report_destroy(struct lkma_report *report)
+{
+	free(report->values);
+	free(report->epochs);
+	report->values = NULL;
+	report->epochs = NULL;
+}
+
+/* @see start_report */
+void lkma_start_report(struct lkma_trie *trie, struct lkma_report *report)
+{
+	report->epoch = atomic_fetch_add(&trie->epoch, 1) + 1;
+}
+
+/* @see node_changed */
+static bool node_changed(struct lkma_trie *trie, struct lkma_report *report,
+			 unsigned long node)
+{
+	return report->epochs[node] == 0 ||
+	    (int32_t)(atomic_load_explicit(&trie->stamps[node],
+					   memory_order_relaxed) -
+		      report->epochs[node]) >= 0;
+}
+
+/**
+ * lkma_get_node_value - Get allocated size from a subtree
+ * @trie:   Trie
+ * @report: Cached totals, after lkma_start_report
+ * @node:   Node id
+ *
+ * @see get_node_value, only the subtrees changed since the previous report
+ * are visited.
+ */
+long lkma_get_node_value(struct lkma_trie *trie, struct lkma_report *report,
+			 unsigned long node)
+{
+	unsigned long child, end;
+	long sum;
+
+	if (!node_changed(trie, report, node))
+		return report->values[node];
+
+	sum = atomic_load(&trie->sizes[node]);
+
+	child = trie->nodes[node].children;
+	end = child + trie->nodes[node].children_num;
+	for (; child < end; child++)
+		sum += lkma_get_node_value(trie, report, child);
+
+	report->values[node] = sum;
+	report->epochs[node] = report->epoch;
+
+	return sum;
+}
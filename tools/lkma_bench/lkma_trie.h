@@ -0,0 +1,121 @@
+/**
+ * Userspace build of the LKMA attribution path.
+ *
+ * The trie of the source files is generated from a "nm -ln vmlinux" dump the
+ * way scripts/kallsyms.c generates kallsyms_trie, and the lookups and the
+ * counters follow kernel/kallsyms.c and modules/lkma/lkma.c, so changes of
+ * the layout or of the hot path can be measured without booting a kernel.
+ * @author Ghennadi Procopciuc
+ */
+#ifndef LKMA_TRIE_H
+#define LKMA_TRIE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * enum lkma_layout - Layout of the file intervals table
+ * @LKMA_LAYOUT_EYTZINGER: Eytzinger order, as kallsyms_ranges_addresses
+ * @LKMA_LAYOUT_SORTED:    Sorted addresses and a binary search, for reference
+ */
+enum lkma_layout {
+	LKMA_LAYOUT_EYTZINGER,
+	LKMA_LAYOUT_SORTED,
+};
+
+/* Same fields as struct kallsyms_trie_node */
+struct lkma_trie_node {
+	uint32_t name;
+	uint32_t parent;
+	uint32_t children;
+	uint32_t children_num;
+};
+
+/**
+ * struct lkma_trie - Generated tables and counters
+ * @nodes:            kallsyms_trie, in BFS order
+ * @names:            kallsyms_trie_names
+ * @nodes_num:        Number of nodes
+ * @ranges_addresses: kallsyms_ranges_addresses, slot 0 unused
+ * @ranges_nodes:     kallsyms_ranges_nodes
+ * @ranges_num:       kallsyms_num_ranges
+ * @sorted_addresses: Interval starts in address order, with a ~0 sentinel
+ * @sorted_nodes:     File node of each sorted interval
+ * @text_start:       Lowest text address, @see lkma_is_ksym_addr
+ * @text_end:         Highest text address
+ * @symbols:          Addresses of the text symbols, to synthesize traces
+ * @symbols_num:      Number of text symbols
+ * @layout:           Table used by lkma_file_node
+ * @sizes:            kallsyms_trie_sizes
+ * @stamps:           kallsyms_trie_stamps
+ * @peaks:            kallsyms_trie_peaks
+ * @epoch:            kallsyms_trie_epoch
+ * @modules_size:     Bytes charged out of the text, to the modules
+ * @mm_node:          Cached "mm" node, @see lkma_from_mm_tree
+ * @arch_mm_node:     Cached "arch/<arch>/mm" node
+ */
+struct lkma_trie {
+	struct lkma_trie_node *nodes;
+	char *names;
+	unsigned long nodes_num;
+
+	unsigned long long *ranges_addresses;
+	uint32_t *ranges_nodes;
+	unsigned long ranges_num;
+
+	unsigned long long *sorted_addresses;
+	uint32_t *sorted_nodes;
+
+	unsigned long long text_start;
+	unsigned long long text_end;
+	unsigned long long *symbols;
+	unsigned long symbols_num;
+	enum lkma_layout layout;
+
+	atomic_long *sizes;
+	atomic_uint *stamps;
+	atomic_long *peaks;
+	atomic_uint epoch;
+	atomic_long modules_size;
+
+	unsigned long mm_node;
+	unsigned long arch_mm_node;
+};
+
+/**
+ * struct lkma_report - Subtree totals kept between reports
+ * @values: Cached total of each subtree
+ * @epochs: Epoch of each cached total, 0 if none
+ * @epoch:  Epoch of the current report
+ * @see lkma_get_node_value
+ */
+struct lkma_report {
+	long *values;
+	uint32_t *epochs;
+	uint32_t epoch;
+};
+
+int lkma_trie_load(struct lkma_trie *trie, FILE *in, const char *prefix);
+void lkma_trie_destroy(struct lkma_trie *trie);
+void lkma_trie_reset(struct lkma_trie *trie);
+
+const char *lkma_node_name(const struct lkma_trie *trie, unsigned long node);
+
+bool lkma_is_ksym_addr(const struct lkma_trie *trie,
+		       unsigned long long address);
+unsigned long lkma_file_node(const struct lkma_trie *trie,
+			     unsigned long long address);
+bool lkma_from_mm_tree(struct lkma_trie *trie, unsigned long long address);
+void lkma_add_memory(struct lkma_trie *trie, unsigned long long address,
+		     long size);
+
+int lkma_report_init(struct lkma_report *report,
+		     const struct lkma_trie *trie);
+void lkma_report_destroy(struct lkma_report *report);
+void lkma_start_report(struct lkma_trie *trie, struct lkma_report *report);
+long lkma_get_node_value(struct lkma_trie *trie, struct lkma_report *report,
+			 unsigned long node);
+
+#endif /* LKMA_TRIE_H */